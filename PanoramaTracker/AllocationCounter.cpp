@@ -0,0 +1,121 @@
+#include "AllocationCounter.h"
+
+namespace
+{
+	//The tally the allocations of this thread are counted into, if any
+	thread_local AllocationCounter::Tally *current_tally = nullptr;
+
+	inline void countAllocation()
+	{
+		if (current_tally) current_tally->Add(1);
+	}
+}
+
+AllocationCounter::Scope::Scope(Tally &tally) : previous_(current_tally)
+{
+	current_tally = &tally;
+}
+
+AllocationCounter::Scope::~Scope()
+{
+	current_tally = previous_;
+}
+
+#if defined(PT_COUNT_ALLOCATIONS) && defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+
+/*
+The debug runtime calls the hook for every allocation of the program, also for the ones made inside the static
+OpenCV libraries, so operator new does not need replacing
+*/
+namespace
+{
+	_CRT_ALLOC_HOOK previous_hook = nullptr;
+
+	int __cdecl allocationHook(int allocType, void *userData, size_t size, int blockType, long requestNumber,
+		const unsigned char *fileName, int lineNumber)
+	{
+		if ((allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC) && blockType != _CRT_BLOCK) countAllocation();
+		return previous_hook ? previous_hook(allocType, userData, size, blockType, requestNumber, fileName, lineNumber) : TRUE;
+	}
+
+	const bool hook_installed = (previous_hook = _CrtSetAllocHook(allocationHook), true);
+}
+
+bool AllocationCounter::SeesMatAllocations()
+{
+	return true;
+}
+#elif defined(PT_COUNT_ALLOCATIONS)
+#include <cstdlib>
+#include <new>
+#include <opencv2/core/core.hpp>
+
+void *operator new(size_t size)
+{
+	countAllocation();
+	void *memory = std::malloc(size > 0 ? size : 1);
+	if (!memory) throw std::bad_alloc();
+	return memory;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+	std::free(memory);
+}
+
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 1)
+namespace
+{
+	//Counts the Mat data allocations and leaves the work to the standard allocator, which also frees the data
+	class CountingMatAllocator : public cv::MatAllocator
+	{
+	public:
+		cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags,
+			cv::UMatUsageFlags usageFlags) const
+		{
+			if (!data) countAllocation();
+			return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		bool allocate(cv::UMatData *data, int accessFlags, cv::UMatUsageFlags usageFlags) const
+		{
+			return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+		}
+
+		void deallocate(cv::UMatData *data) const
+		{
+			cv::Mat::getStdAllocator()->deallocate(data);
+		}
+	};
+
+	CountingMatAllocator mat_allocator;
+	const bool allocator_installed = (cv::Mat::setDefaultAllocator(&mat_allocator), true);
+}
+
+bool AllocationCounter::SeesMatAllocations()
+{
+	return true;
+}
+#else
+bool AllocationCounter::SeesMatAllocations()
+{
+	return false;
+}
+#endif
+#else
+bool AllocationCounter::SeesMatAllocations()
+{
+	return false;
+}
+#endif
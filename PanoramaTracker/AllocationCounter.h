@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PtSettings.h"
+#include <atomic>
+
+/*
+Counts heap allocations when compiled with PT_COUNT_ALLOCATIONS. A Tally only counts the allocations of the threads
+that are inside a Scope of it, so the background threads (mapping, relocalization) do not show up in the count of a frame.
+With the MSVC debug runtime the allocation hook of the CRT sees every malloc, including the Mat data that OpenCV
+allocates with fastMalloc. Otherwise the global operator new is replaced, and the Mat data is counted through the
+default MatAllocator of OpenCV 3.1 and later. Allocations made by the threads of the OpenCV parallel loops
+(e.g. inside remap) are not counted, since they never enter a Scope
+*/
+namespace AllocationCounter
+{
+	//Allocations counted for a piece of work, possibly by several threads
+	class Tally
+	{
+	public:
+		Tally() : count_(0) {}
+		//Copies take the count, so that the owners stay copyable
+		Tally(const Tally &other) : count_(other.Count()) {}
+		Tally &operator=(const Tally &other) { count_ = other.Count(); return *this; }
+		long long Count() const { return count_; }
+		void Reset() { count_ = 0; }
+		//Add allocations counted separately, e.g. by a Tally of another thread
+		void Add(long long count) { count_ += count; }
+
+	private:
+		std::atomic<long long> count_;
+	};
+
+	//Counts the allocations of the calling thread into tally while alive. A nested Scope of the same tally counts them once
+	class Scope
+	{
+	public:
+		explicit Scope(Tally &tally);
+		~Scope();
+
+	private:
+		Tally *previous_;
+		Scope(const Scope&) = delete;
+		Scope &operator=(const Scope&) = delete;
+	};
+
+	//True if the allocations of Mat data are counted, always false without PT_COUNT_ALLOCATIONS
+	bool SeesMatAllocations();
+}
@@ -0,0 +1,200 @@
+#include "Benchmark.h"
+#include "PanoramaTracker.h"
+#include <iostream>
+
+namespace Benchmark
+{
+	//Frames read for a benchmark, enough for a few seconds of tracking without keeping the whole video in memory
+	static const int max_frames_ = 300;
+
+	//Tracking of one run over the frames
+	struct Run
+	{
+		double ms_per_frame;		//Average time of CalculateOrientation
+		int lost_frames;			//Frames after which the tracker was not tracking keypoints
+		float max_velocity;			//Largest change of the orientation between two tracked frames, in degrees
+		std::vector<Point2f> orientations;	//Orientation after every tracked frame
+	};
+
+	static bool loadFrames(const std::string &video, std::vector<Mat> &frames)
+	{
+		VideoCapture cap;
+		cap.open(video);
+		Mat frame;
+		while ((int)frames.size() < max_frames_)
+		{
+			cap >> frame;
+			if (frame.empty()) break;
+			frames.push_back(frame.clone());
+		}
+		if (frames.size() < 2)
+		{
+			std::cout << "Could not read the video " << video << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//The settings of the sample application
+	static PtSettings baseSettings()
+	{
+		PtSettings settings;
+		settings.Set(PT_CAMERA_FOV_VERTICAL, 43);
+		settings.Set(PT_CAMERA_FOV_HORIZONTAL, 57);
+		settings.Set(PT_USE_COLORED_MAP, false);
+		settings.Set(PT_MAX_KEYPOINTS_PER_CELL, 10);
+		settings.Set(PT_SUPPORT_AREA_SIZE, 8);
+		settings.Set(PT_FAST_KEYPOINT_THRESHOLD, 12);
+		settings.Set(PT_PYRAMIDICAL, false);
+		settings.Set(PT_USE_ANDROID_SHIELD, true);
+		settings.Set(PT_ROTATION_INVARIANT, true);
+		return settings;
+	}
+
+	//Track every step:th frame. The map is initialized from the first frame
+	static Run track(const std::vector<Mat> &frames, const PtSettings &settings, int step)
+	{
+		Run run;
+		run.ms_per_frame = 0;
+		run.lost_frames = 0;
+		run.max_velocity = 0;
+		PanoramaTracker tracker(settings);
+		tracker.InitializeMap(frames[0], false);
+		Point2f previous(tracker.GetOrientationX(), tracker.GetOrientationY());
+		int tracked = 0;
+		for (size_t i = step; i < frames.size(); i += step)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			tracker.CalculateOrientation(frames[i]);
+			auto end = std::chrono::high_resolution_clock::now();
+			run.ms_per_frame += std::chrono::duration<double, std::milli>(end - start).count();
+			tracked++;
+
+			Point2f orientation(tracker.GetOrientationX(), tracker.GetOrientationY());
+			if (tracker.tracking_status != PanoramaTracker::TRACKING_KEYPOINTS)
+			{
+				run.lost_frames++;
+			}
+			else
+			{
+				run.max_velocity = std::max(run.max_velocity, std::max(std::abs(orientation.x - previous.x), std::abs(orientation.y - previous.y)));
+			}
+			run.orientations.push_back(orientation);
+			previous = orientation;
+		}
+		if (tracked > 0) run.ms_per_frame /= tracked;
+		return run;
+	}
+
+	//Largest distance of the orientations of run from those of reference at the same frames, in degrees.
+	//reference tracks every frame, and run every step:th
+	static float deviation(const Run &reference, const Run &run, int step)
+	{
+		float largest = 0;
+		for (size_t i = 0; i < run.orientations.size(); i++)
+		{
+			size_t r = (i + 1) * step - 1;
+			if (r >= reference.orientations.size()) break;
+			Point2f d = run.orientations[i] - reference.orientations[r];
+			largest = std::max(largest, std::max(std::abs(d.x), std::abs(d.y)));
+		}
+		return largest;
+	}
+
+	//RMS distance of the orientations of run from those of reference, both tracking every frame, in degrees
+	static float rmsDeviation(const Run &reference, const Run &run)
+	{
+		size_t count = std::min(reference.orientations.size(), run.orientations.size());
+		double sum = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			Point2f d = run.orientations[i] - reference.orientations[i];
+			sum += d.x * d.x + d.y * d.y;
+		}
+		return count > 0 ? (float)std::sqrt(sum / count) : 0;
+	}
+
+	//RMS second difference of the orientations, in degrees per frame squared
+	static float jitter(const Run &run)
+	{
+		double sum = 0;
+		size_t count = 0;
+		for (size_t i = 2; i < run.orientations.size(); i++, count++)
+		{
+			Point2f d = run.orientations[i] - 2 * run.orientations[i - 1] + run.orientations[i - 2];
+			sum += d.x * d.x + d.y * d.y;
+		}
+		return count > 0 ? (float)std::sqrt(sum / count) : 0;
+	}
+
+	bool RunAll(const std::string &video)
+	{
+		std::vector<Mat> frames;
+		if (!loadFrames(video, frames)) return false;
+		CoarseToFine(frames);
+		SubpixelPrecision(frames);
+		DirectAlignment(frames);
+		return true;
+	}
+
+	void CoarseToFine(const std::vector<Mat> &frames)
+	{
+		//A run with skipped frames is tracked if it loses no frames and stays within this many degrees of the run over every frame
+		const float max_deviation = 1.0f;
+		const int max_step = 16;
+
+		PtSettings flat = baseSettings();
+		PtSettings coarse_to_fine = baseSettings();
+		coarse_to_fine.Set(PT_PYRAMIDICAL, true);
+		coarse_to_fine.Set(PT_COARSE_TO_FINE, true);
+		const char *names[] = { "flat", "coarse to fine" };
+		PtSettings *modes[] = { &flat, &coarse_to_fine };
+		for (int m = 0; m < 2; m++)
+		{
+			Run reference = track(frames, *modes[m], 1);
+			float max_velocity = reference.lost_frames == 0 ? reference.max_velocity : 0;
+			int max_tracked_step = reference.lost_frames == 0 ? 1 : 0;
+			for (int step = 2; step <= max_step && max_tracked_step == step - 1; step++)
+			{
+				Run skipping = track(frames, *modes[m], step);
+				if (skipping.lost_frames > 0 || deviation(reference, skipping, step) > max_deviation) break;
+				max_velocity = std::max(max_velocity, skipping.max_velocity);
+				max_tracked_step = step;
+			}
+			std::cout << names[m] << ": " << reference.ms_per_frame << " ms/frame, " << reference.lost_frames << " frames lost, "
+				<< "tracked every " << max_tracked_step << ". frame, largest angular velocity " << max_velocity << " degrees/frame" << std::endl;
+		}
+	}
+
+	void SubpixelPrecision(const std::vector<Mat> &frames)
+	{
+		const int scales[] = { 407, 300, 200 };
+		PtSettings settings = baseSettings();
+		settings.Set(PT_WARPER_SCALE, scales[0]);
+		settings.Set(PT_SUBPIXEL_REFINEMENT, true);
+		Run reference = track(frames, settings, 1);
+		for (int scale : scales)
+		{
+			for (int subpixel = 0; subpixel < 2; subpixel++)
+			{
+				settings.Set(PT_WARPER_SCALE, scale);
+				settings.Set(PT_SUBPIXEL_REFINEMENT, subpixel == 1);
+				Run run = track(frames, settings, 1);
+				std::cout << "warper scale " << scale << (subpixel ? ", sub-pixel: " : ", integer: ") << run.ms_per_frame << " ms/frame, "
+					<< run.lost_frames << " frames lost, RMS deviation " << rmsDeviation(reference, run) << " degrees, jitter " << jitter(run) << std::endl;
+			}
+		}
+	}
+
+	void DirectAlignment(const std::vector<Mat> &frames)
+	{
+		PtSettings settings = baseSettings();
+		Run features = track(frames, settings, 1);
+		settings.Set(PT_DIRECT_ALIGNMENT, true);
+		Run direct = track(frames, settings, 1);
+		std::cout << "features: " << features.ms_per_frame << " ms/frame, " << features.lost_frames << " frames lost, jitter "
+			<< jitter(features) << std::endl;
+		std::cout << "direct alignment: " << direct.ms_per_frame << " ms/frame, " << direct.lost_frames << " frames lost, RMS deviation "
+			<< rmsDeviation(features, direct) << " degrees from the features, jitter " << jitter(direct) << std::endl;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+using namespace cv;
+
+/*
+Benchmarks of the tracking modes on a recorded video. Run with the --benchmark command line argument,
+optionally followed by the path of the video. The frames are decoded before the tracking, so only the
+tracking is timed. Every benchmark prints its results
+*/
+namespace Benchmark
+{
+	//Run all the benchmarks on the video. Returns false if the video could not be read
+	bool RunAll(const std::string &video);
+
+	/*
+	Coarse to fine tracking (PT_COARSE_TO_FINE) against the flat tracking of the full map: the cost of a frame,
+	and the largest angular velocity tracked. Faster motion is simulated by skipping frames
+	*/
+	void CoarseToFine(const std::vector<Mat> &frames);
+
+	/*
+	Angular precision of the tracking against the resolution of the warped frames (PT_WARPER_SCALE), with and without
+	PT_SUBPIXEL_REFINEMENT. The precision is the RMS distance from the tracking at the largest scale with refinement,
+	and the jitter the RMS frame to frame change of the orientation's velocity, which grows when slow pans stall and jump
+	*/
+	void SubpixelPrecision(const std::vector<Mat> &frames);
+
+	/*
+	Direct alignment of the whole frame (PT_DIRECT_ALIGNMENT) against the feature tracking: the cost of a frame,
+	the frames lost, the RMS distance from the feature tracking and the jitter of both
+	*/
+	void DirectAlignment(const std::vector<Mat> &frames);
+}
@@ -18,6 +18,19 @@ cell_height_(cellHeight)
 	initCellStatuses();
 }
 
+CellManager::CellManager(int cellWidth, int cellHeight, int cellCapacity)
+: cell_rows_(NO_OF_CELLS_Y),
+cell_columns_(NO_OF_CELLS_X),
+cell_width_(cellWidth),
+cell_height_(cellHeight)
+{
+	initCellStatuses();
+	for (int i = 0; i < 3; i++)
+	{
+		feature_stores_[i] = FeatureStore(cellCapacity);
+	}
+}
+
 int CellManager::GetCellHeight(MapSize mapSize) const
 {
 	if (mapSize ==  MAP_SIZE_FULL)
@@ -36,29 +49,17 @@ int CellManager::GetCellWidth(MapSize mapSize) const
 	return cell_width_ / 4;
 }
 
-Mat CellManager::GetCellContents(int x, int y, MapSize mapSize, const Mat &map) const
+Rect CellManager::GetCellRect(int x, int y, MapSize mapSize) const
 {
 	//Get the actual cell width and height according to the size of the used map
-	int cw, ch;
-	if (mapSize == MAP_SIZE_FULL)
-	{
-		ch = cell_height_;
-		cw = cell_width_;
-	}
-	else if (mapSize == MAP_SIZE_HALF)
-	{
-		ch = cell_height_ / 2;
-		cw = cell_width_ / 2;
-	}
-	else
-	{
-		ch = cell_height_ / 4;
-		cw = cell_width_ / 4;
-	}
-	int cell_starting_point_x = (x)* cw;
-	int cell_starting_point_y = (y)* ch;
+	int cw = GetCellWidth(mapSize);
+	int ch = GetCellHeight(mapSize);
+	return Rect(x * cw, y * ch, cw, ch);
+}
 
-	return map(Rect(cell_starting_point_x, cell_starting_point_y, cw, ch));
+Mat CellManager::GetCellContents(int x, int y, MapSize mapSize, const PanoramaMap &map) const
+{
+	return map.GetRegion(GetCellRect(x, y, mapSize), mapSize);
 }
 
 void CellManager::initCellStatuses()
@@ -72,23 +73,10 @@ void CellManager::initCellStatuses()
 	}
 }
 
-void CellManager::UpdateCellStatus(int x, int y, Mat &mapMask)
+void CellManager::UpdateCellStatus(int x, int y, const CoverageMap &coverage)
 {
 	//If cell still has uninitialized pixels, status = false
-	//Iterate through the cell
-	bool black = false;
-	uchar *p;
-	for (int j = y * cell_height_; j < y* cell_height_ + cell_height_; j++){
-		p = mapMask.ptr<uchar>(j);
-		
-		for (int i = x * cell_width_; i < x * cell_width_ + cell_width_; i++){
-			if (p[i] == 0){
-				cell_statuses_[x][y] = false;
-				return;
-			}
-		}
-	}
-	cell_statuses_[x][y] = true;
+	cell_statuses_[x][y] = coverage.IsCellComplete(x, y);
 }
 
 bool CellManager::Status(int x, int y) const
@@ -112,17 +100,37 @@ bool CellManager::CellVisible(int x, int y, const Rect &currentViewpoint) const
 }
 
 
+CellRange CellManager::GetVisibleCells(const Rect &viewpoint) const
+{
+	CellRange range;
+	if (cell_width_ <= 0 || cell_height_ <= 0)
+	{
+		return range;
+	}
+
+	//First cell starting at or after the viewpoint edge, and the cell after the last one ending before the other edge
+	range.x_begin = std::max(0, (int)std::ceil((double)viewpoint.x / cell_width_));
+	range.y_begin = std::max(0, (int)std::ceil((double)viewpoint.y / cell_height_));
+	range.x_end = std::min(cell_columns_, (int)std::floor((double)(viewpoint.x + viewpoint.width) / cell_width_));
+	range.y_end = std::min(cell_rows_, (int)std::floor((double)(viewpoint.y + viewpoint.height) / cell_height_));
+
+	//Empty range if the viewpoint does not contain any complete cell
+	if (range.x_end <= range.x_begin || range.y_end <= range.y_begin)
+	{
+		range.x_end = range.x_begin;
+		range.y_end = range.y_begin;
+	}
+	return range;
+}
+
 std::vector<Point> CellManager::GetUnsetVisibleCells(const Rect &viewpoint) const
 {
 	std::vector<Point> cells;
-	for (int i = 0; i < cell_columns_; i++)
+	for (Point cell : GetVisibleCells(viewpoint))
 	{
-		for (int j = 0; j < cell_rows_; j++)
+		if (!Status(cell.x, cell.y))
 		{
-			if (!Status(i, j) && CellVisible(i,j,viewpoint))
-			{
-				cells.push_back(Point(i, j));
-			}
+			cells.push_back(cell);
 		}
 	}
 	return cells;
@@ -130,48 +138,66 @@ std::vector<Point> CellManager::GetUnsetVisibleCells(const Rect &viewpoint) cons
 
 std::vector<PtFeature> CellManager::GetCellKeypoints(int x, int y, PtFeature::KeypointType KpType) const
 {
-	if (KpType == PtFeature::KP_FULL_MAP)
-	{
-		return cell_keypoints_[x][y];
-	}
-	else if (KpType == PtFeature::KP_HALF_MAP)
-	{
-		return cell_keypoints_half_[x][y];
-	}
-	else
+	const FeatureStore &store = GetFeatureStore(KpType);
+	std::vector<PtFeature> keypoints;
+	for (int k = 0; k < store.Count(x, y); k++)
 	{
-		return cell_keypoints_quarter_[x][y];
+		keypoints.push_back(store.GetFeature(x, y, k));
 	}
+	return keypoints;
 }
 
-std::vector<PtFeature>* CellManager::GetCellKeypointsPtr(int x, int y, PtFeature::KeypointType KpType)
+int CellManager::GetCellKeypointCount(int x, int y, PtFeature::KeypointType KpType) const
 {
-	if (KpType == PtFeature::KP_FULL_MAP)
-	{
-		return &cell_keypoints_[x][y];
-	}
-	else if (KpType == PtFeature::KP_HALF_MAP)
-	{
-		return &cell_keypoints_half_[x][y];
-	}
-	else
-	{
-		return &cell_keypoints_quarter_[x][y];
-	}
+	return GetFeatureStore(KpType).Count(x, y);
 }
 
 void CellManager::SetCellKeypoints(int x, int y, PtFeature::KeypointType kpType, const std::vector<PtFeature>& kps)
 {
-	if (kpType == PtFeature::KP_FULL_MAP)
+	GetFeatureStore(kpType).SetCell(x, y, kps);
+}
+
+void CellManager::SetCellCandidates(int x, int y, const std::vector<PtFeature> &candidates)
+{
+	candidates_[x][y].assign(candidates.rbegin(), candidates.rend());
+}
+
+int CellManager::TakeCellCandidates(int x, int y, int count, std::vector<PtFeature> &features)
+{
+	std::vector<PtFeature> &candidates = candidates_[x][y];
+	int taken = 0;
+	while (taken < count && !candidates.empty())
 	{
-		cell_keypoints_[x][y] = kps;
+		features.push_back(candidates.back());
+		candidates.pop_back();
+		taken++;
 	}
-	else if (kpType == PtFeature::KP_HALF_MAP)
+	return taken;
+}
+
+FeatureStore &CellManager::GetFeatureStore(PtFeature::KeypointType kpType)
+{
+	return feature_stores_[kpType];
+}
+
+const FeatureStore &CellManager::GetFeatureStore(PtFeature::KeypointType kpType) const
+{
+	return feature_stores_[kpType];
+}
+
+size_t CellManager::GetFeatureMemoryFootprint() const
+{
+	size_t bytes = 0;
+	for (int i = 0; i < 3; i++)
 	{
-		cell_keypoints_half_[x][y] = kps;
+		bytes += feature_stores_[i].GetMemoryFootprint();
 	}
-	else
+	for (int i = 0; i < cell_columns_; i++)
 	{
-		cell_keypoints_quarter_[x][y] = kps;
+		for (int j = 0; j < cell_rows_; j++)
+		{
+			bytes += candidates_[i][j].capacity() * sizeof(PtFeature);
+		}
 	}
+	return bytes;
 }
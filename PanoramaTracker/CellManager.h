@@ -1,5 +1,41 @@
 #pragma once
 #include "PtFeature.h"
+#include "FeatureStore.h"
+
+/*
+Half-open range of cell indices [x_begin, x_end) x [y_begin, y_end).
+Iterating it gives the cells as Points in the same order as looping x in the outer and y in the inner loop
+*/
+struct CellRange
+{
+	int x_begin = 0;
+	int x_end = 0;
+	int y_begin = 0;
+	int y_end = 0;
+
+	class Iterator
+	{
+	public:
+		Iterator(const CellRange *range, int index) : range_(range), index_(index){}
+		Point operator*() const
+		{
+			int rows = range_->y_end - range_->y_begin;
+			return Point(range_->x_begin + index_ / rows, range_->y_begin + index_ % rows);
+		}
+		Iterator &operator++(){ index_++; return *this; }
+		bool operator!=(const Iterator &other) const { return index_ != other.index_; }
+	private:
+		const CellRange *range_;
+		int index_;
+	};
+
+	Iterator begin() const { return Iterator(this, 0); }
+	Iterator end() const { return Iterator(this, Size()); }
+
+	//Number of cells in the range
+	int Size() const { return (x_end - x_begin) * (y_end - y_begin); }
+	bool Contains(int x, int y) const { return x >= x_begin && x < x_end && y >= y_begin && y < y_end; }
+};
 
 /*
 Class to hold info of every cell and manage their information and contents
@@ -10,16 +46,20 @@ public:
 	//Constructors
 	CellManager();
 	CellManager(int cellWidth, int cellHeight);
+	CellManager(int cellWidth, int cellHeight, int cellCapacity);
 	
 	//Get the size of the cells, dependant on the used size of the mapmapsize
 	int GetCellHeight(MapSize mapSize) const;
 	int GetCellWidth(MapSize mapSize) const;
 
-	//Get the Mat of the cells contents from cell x,y
-	Mat GetCellContents(int x, int y, MapSize mapSize,const Mat &map) const;
+	//Get the area of cell x,y in a map of size mapSize
+	Rect GetCellRect(int x, int y, MapSize mapSize) const;
+
+	//Get the Mat of the cells contents from cell x,y. The cells are aligned with the map tiles, so no copying is done
+	Mat GetCellContents(int x, int y, MapSize mapSize, const PanoramaMap &map) const;
 
-	//Update the status of the cell at x,y by checking if the pixels are set in the mask
-	void UpdateCellStatus(int x, int y, Mat &mapMask);
+	//Update the status of the cell at x,y by checking if all pixels of the cell are set in the map coverage
+	void UpdateCellStatus(int x, int y, const CoverageMap &coverage);
 
 	/*
 	Return or set the status of the cell at x,y.
@@ -31,14 +71,33 @@ public:
 	//Check if the cell is completely within the current viewpoint
 	bool CellVisible(int x, int y, const Rect &currentViewpoint) const; 
 
+	//Get the range of cells that are completely inside the viewpoint, i.e. the cells for which CellVisible is true
+	CellRange GetVisibleCells(const Rect &viewpoint) const;
+
 	//Get all cells (as x,y coordinates) that are visible, but unset
 	std::vector<Point> GetUnsetVisibleCells(const Rect &viewpoint) const;
 
 	//Functions for getting and setting keypoints in a cell x, y
 	std::vector<PtFeature> GetCellKeypoints(int x, int y, PtFeature::KeypointType KpType) const;
-	std::vector<PtFeature>* GetCellKeypointsPtr(int x, int y, PtFeature::KeypointType KpType);
+	int GetCellKeypointCount(int x, int y, PtFeature::KeypointType KpType) const;
 	void SetCellKeypoints(int x, int y, PtFeature::KeypointType kpType, const std::vector<PtFeature> &kps);
 
+	/*
+	Set the keypoint candidates of the full map cell x,y, best first. They are found when the cell is completed,
+	and used to re-seed the cell when all of its keypoints have been removed, without searching its pixels again
+	*/
+	void SetCellCandidates(int x, int y, const std::vector<PtFeature> &candidates);
+
+	//Move up to count of the best unused candidates of cell x,y to features. Returns the number of candidates moved
+	int TakeCellCandidates(int x, int y, int count, std::vector<PtFeature> &features);
+
+	//Get the store holding the keypoints of all cells for the keypoint type
+	FeatureStore &GetFeatureStore(PtFeature::KeypointType kpType);
+	const FeatureStore &GetFeatureStore(PtFeature::KeypointType kpType) const;
+
+	//Bytes used by the keypoints of all keypoint types
+	size_t GetFeatureMemoryFootprint() const;
+
 private:
 	//Cell information
 	int cell_rows_;
@@ -46,10 +105,11 @@ private:
 	int cell_width_;
 	int cell_height_;
 
-	//Vectors containing all keypoints for each cell
-	std::vector<PtFeature> cell_keypoints_[NO_OF_CELLS_X][NO_OF_CELLS_Y];
-	std::vector<PtFeature> cell_keypoints_half_[NO_OF_CELLS_X][NO_OF_CELLS_Y];
-	std::vector<PtFeature> cell_keypoints_quarter_[NO_OF_CELLS_X][NO_OF_CELLS_Y];
+	//Keypoints of all cells, indexed with PtFeature::KeypointType
+	FeatureStore feature_stores_[3];
+
+	//Unused keypoint candidates of the full map cells, the best last so that taking them does not move the rest
+	std::vector<PtFeature> candidates_[NO_OF_CELLS_X][NO_OF_CELLS_Y];
 
 	//Statuses of all cells, i.e. are they completely filled with pixels or not
 	bool cell_statuses_[NO_OF_CELLS_X][NO_OF_CELLS_Y];
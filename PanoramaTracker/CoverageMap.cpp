@@ -0,0 +1,220 @@
+#include "CoverageMap.h"
+
+CoverageMap::CoverageMap()
+: map_size_(0, 0),
+cell_size_(0, 0),
+cells_x_(0),
+cells_y_(0),
+words_per_row_(0)
+{
+}
+
+CoverageMap::CoverageMap(Size mapSize, Size cellSize, int cellsX, int cellsY)
+: map_size_(mapSize),
+cell_size_(cellSize),
+cells_x_(cellsX),
+cells_y_(cellsY)
+{
+	words_per_row_ = (mapSize.width + 63) / 64;
+	bits_.assign((size_t)words_per_row_ * mapSize.height, 0);
+	cell_counts_.assign(cellsX * cellsY, 0);
+}
+
+int CoverageMap::popCount(uint64_t word)
+{
+	word = word - ((word >> 1) & 0x5555555555555555ULL);
+	word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((word * 0x0101010101010101ULL) >> 56);
+}
+
+void CoverageMap::packRow(const uchar *row, int length, std::vector<uint64_t> &bits)
+{
+	bits.assign((length + 63) / 64, 0);
+	int x = 0;
+#if CV_SIMD128
+	//16 pixels at a time, the sign mask of the comparison gives their bits directly
+	v_uint8x16 zero = v_setzero_u8();
+	for (; x + 16 <= length; x += 16)
+	{
+		uint64_t mask = (uint64_t)v_signmask(v_load(row + x) > zero);
+		bits[x / 64] |= mask << (x % 64);
+	}
+#endif
+	for (; x < length; x++)
+	{
+		if (row[x]) bits[x / 64] |= 1ULL << (x % 64);
+	}
+}
+
+void CoverageMap::countBits(int y, int x, uint64_t word, int sign)
+{
+	int cy = y / cell_size_.height;
+	if (cy >= cells_y_) return;
+	//Split the word at cell borders
+	while (word)
+	{
+		int cx = x / cell_size_.width;
+		if (cx >= cells_x_) return;
+		int cell_end = (cx + 1) * cell_size_.width - x;
+		uint64_t in_cell = cell_end >= 64 ? word : word & ((1ULL << cell_end) - 1);
+		cell_counts_[cx * cells_y_ + cy] += sign * popCount(in_cell);
+		if (cell_end >= 64) return;
+		word = word >> cell_end;
+		x += cell_end;
+	}
+}
+
+int CoverageMap::trailingZeros(uint64_t word)
+{
+	return popCount((word & (~word + 1)) - 1);
+}
+
+uint64_t CoverageMap::bitRange(int begin, int end)
+{
+	return (end >= 64 ? ~0ULL : ((1ULL << end) - 1)) & ~((1ULL << begin) - 1);
+}
+
+bool CoverageMap::isRowSet(int y, int x, int length) const
+{
+	const uint64_t *map_row = &bits_[(size_t)y * words_per_row_];
+	for (int w = x / 64; w * 64 < x + length; w++)
+	{
+		uint64_t range = bitRange(std::max(x - w * 64, 0), std::min(x + length - w * 64, 64));
+		if ((map_row[w] & range) != range) return false;
+	}
+	return true;
+}
+
+void CoverageMap::appendSpans(int y, int x, uint64_t word, std::vector<Span> &spans)
+{
+	while (word)
+	{
+		//A run of set bits starts at the lowest set bit
+		int begin = trailingZeros(word);
+		uint64_t rest = ~(word >> begin);
+		int end = rest ? begin + trailingZeros(rest) : 64;
+
+		//Runs continuing from the previous word extend its span
+		if (!spans.empty() && spans.back().y == y && spans.back().x_end == x + begin)
+		{
+			spans.back().x_end = x + end;
+		}
+		else
+		{
+			Span span = { y, x + begin, x + end };
+			spans.push_back(span);
+		}
+		if (end >= 64) return;
+		word &= ~0ULL << end;
+	}
+}
+
+void CoverageMap::Add(const Mat &mask, Point origin, std::vector<Span> &newSpans)
+{
+	newSpans.clear();
+	Rect area = Rect(origin, mask.size()) & Rect(0, 0, map_size_.width, map_size_.height);
+	for (int y = area.y; y < area.y + area.height; y++)
+	{
+		//Once an area is mapped, its rows have nothing to add
+		if (isRowSet(y, area.x, area.width)) continue;
+
+		packRow(mask.ptr<uchar>(y - origin.y) + (area.x - origin.x), area.width, packed_);
+		uint64_t *map_row = &bits_[(size_t)y * words_per_row_];
+
+		//Shift the packed row to the bit position of the area in the map words
+		int shift = area.x % 64;
+		int first_word = area.x / 64;
+		for (size_t w = 0; w <= packed_.size(); w++)
+		{
+			uint64_t word = w < packed_.size() ? packed_[w] << shift : 0;
+			if (shift > 0 && w > 0) word |= packed_[w - 1] >> (64 - shift);
+			int map_word = first_word + (int)w;
+			if (word == 0 || map_word >= words_per_row_) continue;
+
+			//Only the new bits are written and counted
+			uint64_t new_bits = word & ~map_row[map_word];
+			if (new_bits == 0) continue;
+			map_row[map_word] |= new_bits;
+			countBits(y, map_word * 64, new_bits, 1);
+			appendSpans(y, map_word * 64, new_bits, newSpans);
+		}
+	}
+}
+
+void CoverageMap::Clear(const Rect &area)
+{
+	Rect clipped = area & Rect(0, 0, map_size_.width, map_size_.height);
+	for (int y = clipped.y; y < clipped.y + clipped.height; y++)
+	{
+		uint64_t *map_row = &bits_[(size_t)y * words_per_row_];
+		for (int w = clipped.x / 64; w * 64 < clipped.x + clipped.width; w++)
+		{
+			//Bits of the word inside the area
+			uint64_t range = bitRange(std::max(clipped.x - w * 64, 0), std::min(clipped.x + clipped.width - w * 64, 64));
+			uint64_t cleared = map_row[w] & range;
+			if (cleared == 0) continue;
+			map_row[w] &= ~cleared;
+			countBits(y, w * 64, cleared, -1);
+		}
+	}
+}
+
+bool CoverageMap::IsSet(int x, int y) const
+{
+	return (bits_[(size_t)y * words_per_row_ + x / 64] >> (x % 64)) & 1;
+}
+
+int CoverageMap::GetCellCount(int x, int y) const
+{
+	return cell_counts_[x * cells_y_ + y];
+}
+
+bool CoverageMap::IsCellComplete(int x, int y) const
+{
+	return cell_size_.area() > 0 && GetCellCount(x, y) == cell_size_.area();
+}
+
+Mat CoverageMap::ToMat(const Rect &area, uchar value) const
+{
+	Mat mask = Mat::zeros(area.size(), CV_8U);
+	Rect clipped = area & Rect(0, 0, map_size_.width, map_size_.height);
+	for (int y = clipped.y; y < clipped.y + clipped.height; y++)
+	{
+		uchar *row = mask.ptr<uchar>(y - area.y);
+		const uint64_t *map_row = &bits_[(size_t)y * words_per_row_];
+		//Unpack a word at a time. Empty and full words are the common case inside and outside the mapped area
+		for (int w = clipped.x / 64; w * 64 < clipped.x + clipped.width; w++)
+		{
+			uint64_t word = map_row[w];
+			int begin = std::max(clipped.x, w * 64);
+			int end = std::min(clipped.x + clipped.width, w * 64 + 64);
+			if (word == 0) continue;
+			if (word == ~0ULL)
+			{
+				std::fill(row + begin - area.x, row + end - area.x, value);
+				continue;
+			}
+			for (int x = begin; x < end; x++)
+			{
+				if ((word >> (x - w * 64)) & 1) row[x - area.x] = value;
+			}
+		}
+	}
+	return mask;
+}
+
+Mat CoverageMap::ToMat(uchar value) const
+{
+	return ToMat(Rect(0, 0, map_size_.width, map_size_.height), value);
+}
+
+Size CoverageMap::GetSize() const
+{
+	return map_size_;
+}
+
+size_t CoverageMap::GetMemoryFootprint() const
+{
+	return bits_.size() * sizeof(uint64_t) + cell_counts_.size() * sizeof(int);
+}
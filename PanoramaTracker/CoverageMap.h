@@ -0,0 +1,89 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <vector>
+#include <stdint.h>
+#include <algorithm>
+
+using namespace cv;
+
+/*
+Coverage of the map, i.e. which pixels of the map have been set, stored as one bit per pixel.
+Keeps a count of set pixels for every cell, so checking if a cell is complete does not require reading its pixels
+*/
+class CoverageMap
+{
+public:
+	//Pixels x_begin..x_end-1 of the map row y
+	struct Span
+	{
+		int y;
+		int x_begin;
+		int x_end;
+	};
+
+	CoverageMap();
+	CoverageMap(Size mapSize, Size cellSize, int cellsX, int cellsY);
+
+	/*
+	Set the pixels that are non-zero in mask, with mask placed at origin in the map.
+	newSpans gets the pixels that were not set before as spans of the map rows, in row order.
+	Rows of the area that are already set are skipped without reading the mask
+	*/
+	void Add(const Mat &mask, Point origin, std::vector<Span> &newSpans);
+
+	//Unset all pixels of the area
+	void Clear(const Rect &area);
+
+	bool IsSet(int x, int y) const;
+
+	//Number of set pixels and completeness of the cell x,y
+	int GetCellCount(int x, int y) const;
+	bool IsCellComplete(int x, int y) const;
+
+	//Get the coverage of the area as an 8-bit mask, with value for the set pixels
+	Mat ToMat(const Rect &area, uchar value = 250) const;
+	Mat ToMat(uchar value = 250) const;
+
+	Size GetSize() const;
+	size_t GetMemoryFootprint() const;
+
+private:
+	Size map_size_;
+	Size cell_size_;
+	int cells_x_;
+	int cells_y_;
+	int words_per_row_;
+
+	//Rows of the map, 64 pixels per word. Bit i of word w is pixel 64 * w + i
+	std::vector<uint64_t> bits_;
+
+	//Set pixels per cell, cell x,y is at x * cells_y_ + y
+	std::vector<int> cell_counts_;
+
+	//Packed mask row of Add, kept so that adding does not allocate
+	std::vector<uint64_t> packed_;
+
+	//Pack the non-zero pixels of a mask row to bits, starting from bit 0 of bits
+	static void packRow(const uchar *row, int length, std::vector<uint64_t> &bits);
+
+	//Number of set bits in a word
+	static int popCount(uint64_t word);
+
+	//Index of the lowest set bit of a non-zero word
+	static int trailingZeros(uint64_t word);
+
+	//Bits begin..end-1 of a word
+	static uint64_t bitRange(int begin, int end);
+
+	//Are all pixels x..x+length-1 of row y set
+	bool isRowSet(int y, int x, int length) const;
+
+	//Add the runs of set bits of word, which holds the pixels x..x+63 of row y, to spans
+	static void appendSpans(int y, int x, uint64_t word, std::vector<Span> &spans);
+
+	//Add count to the cells that row y and columns x..x+63 of word belong to
+	void countBits(int y, int x, uint64_t word, int sign);
+};
@@ -1,10 +1,12 @@
 #include "DebugTimer.h"
 
 DebugTimer::DebugTimer(){
-
+	//Reserve the space for all timers up front, so that the timers don't allocate during tracking
+	results.reserve(MAX_TIMERS);
+	startedTimers.reserve(MAX_TIMERS);
 }
 
-void DebugTimer::StartTimer(std::string tag){
+void DebugTimer::StartTimer(const char *tag){
 	if (startedTimers.size() < MAX_TIMERS){
 		//Assumes that no timer with the same name exists
 		//i.e. usually means that timers should be cleared after each frame
@@ -16,11 +18,11 @@ void DebugTimer::StartTimer(std::string tag){
 	}
 }
 
-void DebugTimer::StopTimer(std::string tag){
-	if (startedTimers.size() < MAX_TIMERS){
+void DebugTimer::StopTimer(const char *tag){
+	if (results.size() < MAX_TIMERS){
 		RunningTimer rt;
 		findRunningTimer(tag, rt);
-		if (rt.tag == ERROR_TAG) return;
+		if (rt.tag == nullptr) return;
 
 		auto end = std::chrono::high_resolution_clock::now();
 		TimerResult tr;
@@ -35,20 +37,20 @@ void DebugTimer::ClearAll(){
 	startedTimers.clear();
 }
 
-vector<DebugTimer::TimerResult> DebugTimer::GetResults(){
+const vector<DebugTimer::TimerResult> &DebugTimer::GetResults() const{
 	return results;
 }
 
-void DebugTimer::findRunningTimer(string tag, RunningTimer &timer){
+void DebugTimer::findRunningTimer(const char *tag, RunningTimer &timer){
 	for (int i = 0; i < startedTimers.size(); i++){
-		if (startedTimers.at(i).tag == tag){
+		if (strcmp(startedTimers.at(i).tag, tag) == 0){
 			timer = startedTimers.at(i);
 			return;
 		}
 	}
-	//If not found, return a -1 timer
+	//If not found, return a timer without a tag
 	RunningTimer rt;
-	rt.tag = ERROR_TAG;
+	rt.tag = nullptr;
 	timer = rt;
 }
 
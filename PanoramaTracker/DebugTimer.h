@@ -5,18 +5,19 @@
 #include <vector>
 #include <sstream>
 #include <iomanip>
-#define ERROR_TAG "timer_not_found_err"
+#include <cstring>
 #define MAX_TIMERS 32
 
 using namespace std;
 /*
 A class that can be used to stop and start timers 
 which can be used for performance profiling.
+The tags are string literals, so timing a block does not allocate
 */
 class DebugTimer{
 public:
 	struct TimerResult{
-		string tag;
+		const char *tag;
 		float milliseconds;
 		string toString(){
 			stringstream ss;
@@ -26,17 +27,17 @@ public:
 	};
 
 	struct RunningTimer{
-		string tag;
+		const char *tag;
 		chrono::time_point<chrono::system_clock, chrono::system_clock::duration> start;
 	};
 
 	DebugTimer();
-	void StartTimer(string tag);
-	void StopTimer(string tag);
+	void StartTimer(const char *tag);
+	void StopTimer(const char *tag);
 	void ClearAll();
-	vector<TimerResult> GetResults();
+	const vector<TimerResult> &GetResults() const;
 private:
 	vector<TimerResult> results;
 	vector<RunningTimer> startedTimers;
-	void findRunningTimer(string tag, RunningTimer &timer);
+	void findRunningTimer(const char *tag, RunningTimer &timer);
 };
\ No newline at end of file
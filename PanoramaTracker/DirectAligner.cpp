@@ -0,0 +1,166 @@
+#include "DirectAligner.h"
+#include <limits>
+
+DirectAligner::DirectAligner(int levels, int maxIterations, float minStep)
+: levels_(levels), max_iterations_(maxIterations), min_step_(minStep)
+{
+}
+
+void DirectAligner::SetTemplate(const Mat &templ, const Mat &templMask)
+{
+	//Don't go to levels too small to contain any structure
+	int levels = 1;
+	while (levels < levels_ && std::min(templ.cols, templ.rows) >> levels >= 32) levels++;
+	buildPyramid(templ, templMask, levels, templ_pyr_, templ_mask_pyr_);
+	steepest_pyr_.resize(levels);
+	for (int level = 0; level < levels; level++)
+	{
+		steepestDescent(templ_pyr_[level], steepest_pyr_[level]);
+	}
+}
+
+bool DirectAligner::Align(const Mat &frame, const Mat &frameMask, Motion &motion)
+{
+	int levels = (int)templ_pyr_.size();
+	if (levels == 0) return false;
+	buildPyramid(frame, frameMask, levels, frame_pyr_, frame_mask_pyr_);
+
+	//Coarse to fine. The translation doubles from level to level and the angle stays the same
+	Point2f translation = motion.translation * (1.f / (1 << (levels - 1)));
+	float angle = motion.angle;
+	motion.iterations = 0;
+	for (int level = levels - 1; level >= 0; level--)
+	{
+		if (!alignLevel(level, translation, angle, motion)) return false;
+		if (level > 0) translation *= 2;
+	}
+	motion.translation = translation;
+	motion.angle = angle;
+	return true;
+}
+
+void DirectAligner::buildPyramid(const Mat &image, const Mat &mask, int levels, std::vector<Mat> &pyramid, std::vector<Mat> &maskPyramid)
+{
+	pyramid.resize(levels);
+	maskPyramid.resize(levels);
+	image.convertTo(pyramid[0], CV_32F);
+	erode(mask, maskPyramid[0], Mat());
+	for (int i = 1; i < levels; i++)
+	{
+		pyrDown(pyramid[i - 1], pyramid[i]);
+		resize(maskPyramid[i - 1], maskPyramid[i], pyramid[i].size(), 0, 0, INTER_NEAREST);
+		erode(maskPyramid[i], maskPyramid[i], Mat());
+	}
+}
+
+void DirectAligner::steepestDescent(const Mat &templ, Mat &steepest)
+{
+	//The Jacobian columns are the x and y translation and the angle around the center.
+	//The border pixels have no central difference and are left out
+	Point2f center(templ.cols / 2.f, templ.rows / 2.f);
+	steepest.create(templ.rows, templ.cols, CV_32FC3);
+	for (int y = 1; y < templ.rows - 1; y++)
+	{
+		const float *t_row = templ.ptr<float>(y);
+		const float *t_up = templ.ptr<float>(y - 1);
+		const float *t_down = templ.ptr<float>(y + 1);
+		float *sd = steepest.ptr<float>(y);
+		for (int x = 1; x < templ.cols - 1; x++)
+		{
+			float gx = (t_row[x + 1] - t_row[x - 1]) / 2;
+			float gy = (t_down[x] - t_up[x]) / 2;
+			sd[3 * x] = gx;
+			sd[3 * x + 1] = gy;
+			sd[3 * x + 2] = -gx * (y - center.y) + gy * (x - center.x);
+		}
+	}
+}
+
+bool DirectAligner::alignLevel(int level, Point2f &translation, float &angle, Motion &motion)
+{
+	const Mat &templ = templ_pyr_[level];
+	const Mat &templ_mask = templ_mask_pyr_[level];
+	Point2f center(templ.cols / 2.f, templ.rows / 2.f);
+
+	const Mat &steepest = steepest_pyr_[level];
+
+	float radius = std::max(center.x, center.y);
+	for (int iteration = 0; iteration < max_iterations_; iteration++)
+	{
+		//Sample the frame at the template pixels moved by the current motion
+		Mat_<double> warp = warpMatrix(translation, angle, center);
+		warpAffine(frame_pyr_[level], warped_, warp, templ.size(), INTER_LINEAR | WARP_INVERSE_MAP);
+		warpAffine(frame_mask_pyr_[level], warped_mask_, warp, templ.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+
+		//Accumulate the Gauss-Newton system over the pixels valid in both images
+		double h[3][3] = { { 0 } }, b[3] = { 0 };
+		double error = 0, templ_sum = 0, warped_sum = 0, gradient_sum = 0;
+		int count = 0;
+		for (int y = 1; y < templ.rows - 1; y++)
+		{
+			const float *t_row = templ.ptr<float>(y);
+			const float *w_row = warped_.ptr<float>(y);
+			const uchar *tm_row = templ_mask.ptr<uchar>(y);
+			const uchar *wm_row = warped_mask_.ptr<uchar>(y);
+			const float *sd = steepest.ptr<float>(y);
+			for (int x = 1; x < templ.cols - 1; x++)
+			{
+				if (!tm_row[x] || !wm_row[x]) continue;
+				float e = w_row[x] - t_row[x];
+				const float *s = sd + 3 * x;
+				for (int i = 0; i < 3; i++)
+				{
+					b[i] += s[i] * e;
+					for (int j = i; j < 3; j++) h[i][j] += s[i] * s[j];
+				}
+				error += e * e;
+				gradient_sum += s[0] * s[0] + s[1] * s[1];
+				templ_sum += t_row[x] * t_row[x];
+				warped_sum += w_row[x] * w_row[x];
+				count++;
+			}
+		}
+		if (count < min_pixels_) return false;
+		motion.error = templ_sum > 0 && warped_sum > 0 ? (float)std::min(1.0, error / std::sqrt(templ_sum * warped_sum)) : 1;
+		//A residual of e at a gradient of g is what a displacement of e / g leaves, so the ratio tells how far the
+		//alignment is off. Level 0 is aligned last, so the reported value is in pixels of the frame
+		motion.deviation = gradient_sum > 0 ? (float)std::sqrt(error / gradient_sum) : std::numeric_limits<float>::max();
+		motion.iterations++;
+
+		//Solve the 3x3 system by Cramer's rule. A textureless region gives a singular system
+		h[1][0] = h[0][1]; h[2][0] = h[0][2]; h[2][1] = h[1][2];
+		double det = h[0][0] * (h[1][1] * h[2][2] - h[1][2] * h[2][1])
+			- h[0][1] * (h[1][0] * h[2][2] - h[1][2] * h[2][0])
+			+ h[0][2] * (h[1][0] * h[2][1] - h[1][1] * h[2][0]);
+		if (std::abs(det) < 1e-9) return false;
+		double delta[3];
+		for (int k = 0; k < 3; k++)
+		{
+			double m[3][3];
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					m[i][j] = j == k ? b[i] : h[i][j];
+			delta[k] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+				- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+				+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+		}
+
+		//Compose with the inverse of the step: the angle decreases by the step angle, and the step translation is rotated to the new angle
+		angle -= (float)delta[2];
+		float c = std::cos(angle), s = std::sin(angle);
+		translation.x -= (float)(c * delta[0] - s * delta[1]);
+		translation.y -= (float)(s * delta[0] + c * delta[1]);
+
+		if (std::abs(delta[0]) < min_step_ && std::abs(delta[1]) < min_step_ && std::abs(delta[2]) * radius < min_step_) break;
+	}
+	return true;
+}
+
+Mat_<double> DirectAligner::warpMatrix(Point2f translation, float angle, Point2f center)
+{
+	double c = std::cos(angle), s = std::sin(angle);
+	Mat_<double> warp(2, 3);
+	warp(0, 0) = c; warp(0, 1) = -s; warp(0, 2) = center.x + translation.x - (c * center.x - s * center.y);
+	warp(1, 0) = s; warp(1, 1) = c; warp(1, 2) = center.y + translation.y - (s * center.x + c * center.y);
+	return warp;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <vector>
+
+using namespace cv;
+
+/*
+Direct photometric alignment of the warped frame against the map region under the viewpoint.
+Inverse compositional Lucas-Kanade on an image pyramid: the gradients of the map region are computed once when it is set,
+so a template kept for several frames costs nothing more, and each iteration only samples the frame. On the cylinder the yaw and pitch of the camera move the frame, and the
+roll rotates it around its center, so the motion is a translation and a rotation around the center
+*/
+class DirectAligner
+{
+public:
+	//A pixel x of the map region is at R(angle) * (x - center) + center + translation in the frame, angle in radians
+	struct Motion
+	{
+		Point2f translation;
+		float angle;
+		float error;	//Normalized squared difference of the aligned images, comparable to CV_TM_SQDIFF_NORMED
+		float deviation;	//RMS error of the aligned pixels divided by the RMS gradient of the template: the displacement it implies, in pixels
+		int iterations;	//Iterations used on all levels
+	};
+
+	DirectAligner(int levels = 3, int maxIterations = 20, float minStep = 0.02f);
+
+	//Set the CV_8UC1 template the frames are aligned to, and build its pyramid and steepest descent images. The mask marks the pixels that contain image data
+	void SetTemplate(const Mat &templ, const Mat &templMask);
+
+	/*
+	Align frame to the template, CV_8UC1 and of the same size. The mask marks the pixels that contain image data.
+	motion is used as the initial guess, and is set to the result. Returns false if too few pixels overlap
+	*/
+	bool Align(const Mat &frame, const Mat &frameMask, Motion &motion);
+
+private:
+	int levels_;
+	int max_iterations_;
+	float min_step_;
+
+	//Smallest number of overlapping pixels for a reliable step
+	static const int min_pixels_ = 64;
+
+	//Pyramids and buffers, reused between frames. The template ones stay until the template is set again
+	std::vector<Mat> templ_pyr_;
+	std::vector<Mat> templ_mask_pyr_;
+	std::vector<Mat> steepest_pyr_;		//Steepest descent images of the template levels, CV_32FC3
+	std::vector<Mat> frame_pyr_;
+	std::vector<Mat> frame_mask_pyr_;
+	Mat warped_;
+	Mat warped_mask_;
+
+	//Build levels of a float image pyramid and its mask pyramid. The masks are eroded so that the blurred borders are not used
+	static void buildPyramid(const Mat &image, const Mat &mask, int levels, std::vector<Mat> &pyramid, std::vector<Mat> &maskPyramid);
+
+	//Steepest descent images of a template level: its gradient times the Jacobian of the motion at zero
+	static void steepestDescent(const Mat &templ, Mat &steepest);
+
+	//Iterate the alignment on a single pyramid level
+	bool alignLevel(int level, Point2f &translation, float &angle, Motion &motion);
+
+	//Affine matrix of the motion, mapping template pixels to frame pixels
+	static Mat_<double> warpMatrix(Point2f translation, float angle, Point2f center);
+};
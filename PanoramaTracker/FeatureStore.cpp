@@ -0,0 +1,124 @@
+#include "FeatureStore.h"
+
+FeatureStore::FeatureStore()
+: cell_capacity_(0)
+{
+	std::fill(counts_, counts_ + NO_OF_CELLS_X * NO_OF_CELLS_Y, 0);
+}
+
+FeatureStore::FeatureStore(int cellCapacity)
+: cell_capacity_(0)
+{
+	std::fill(counts_, counts_ + NO_OF_CELLS_X * NO_OF_CELLS_Y, 0);
+	setCapacity(cellCapacity);
+}
+
+int FeatureStore::cellIndex(int x, int y) const
+{
+	return x * NO_OF_CELLS_Y + y;
+}
+
+int FeatureStore::Count(int x, int y) const
+{
+	return counts_[cellIndex(x, y)];
+}
+
+int FeatureStore::Begin(int x, int y) const
+{
+	return cellIndex(x, y) * cell_capacity_;
+}
+
+void FeatureStore::SetCell(int x, int y, const std::vector<PtFeature> &features)
+{
+	if ((int)features.size() > cell_capacity_)
+	{
+		setCapacity(features.size());
+	}
+	int slot = Begin(x, y);
+	for (size_t k = 0; k < features.size(); k++, slot++)
+	{
+		pt_cell[slot] = features.at(k).pt_cell;
+		pt_map[slot] = features.at(k).pt_map;
+		quality[slot] = features.at(k).quality;
+		movement_x[slot] = features.at(k).movement_x;
+		movement_y[slot] = features.at(k).movement_y;
+		id[slot] = features.at(k).GetId();
+	}
+	counts_[cellIndex(x, y)] = features.size();
+}
+
+void FeatureStore::Remove(int x, int y, int k)
+{
+	int &count = counts_[cellIndex(x, y)];
+	int slot = Begin(x, y) + k;
+	int last = Begin(x, y) + count - 1;
+	if (slot != last)
+	{
+		pt_cell[slot] = pt_cell[last];
+		pt_map[slot] = pt_map[last];
+		quality[slot] = quality[last];
+		movement_x[slot] = movement_x[last];
+		movement_y[slot] = movement_y[last];
+		id[slot] = id[last];
+	}
+	count--;
+}
+
+Point FeatureStore::GetCell(int slot) const
+{
+	int cell = slot / cell_capacity_;
+	return Point(cell / NO_OF_CELLS_Y, cell % NO_OF_CELLS_Y);
+}
+
+PtFeature FeatureStore::GetFeature(int x, int y, int k) const
+{
+	int slot = Begin(x, y) + k;
+	PtFeature feature(pt_cell[slot], pt_map[slot], id[slot]);
+	feature.quality = quality[slot];
+	feature.movement_x = movement_x[slot];
+	feature.movement_y = movement_y[slot];
+	return feature;
+}
+
+int FeatureStore::GetCellCapacity() const
+{
+	return cell_capacity_;
+}
+
+size_t FeatureStore::GetMemoryFootprint() const
+{
+	size_t slots = pt_cell.capacity();
+	return sizeof(FeatureStore) + slots * (2 * sizeof(Point) + sizeof(float) + 3 * sizeof(int));
+}
+
+void FeatureStore::setCapacity(int cellCapacity)
+{
+	FeatureStore resized;
+	size_t slots = (size_t)cellCapacity * NO_OF_CELLS_X * NO_OF_CELLS_Y;
+	resized.cell_capacity_ = cellCapacity;
+	resized.pt_cell.resize(slots);
+	resized.pt_map.resize(slots);
+	resized.quality.resize(slots);
+	resized.movement_x.resize(slots, -1000);
+	resized.movement_y.resize(slots, -1000);
+	resized.id.resize(slots);
+
+	//Copy the features of every cell to the start of its new block
+	for (int c = 0; c < NO_OF_CELLS_X * NO_OF_CELLS_Y; c++)
+	{
+		int count = std::min(counts_[c], cellCapacity);
+		for (int k = 0; k < count; k++)
+		{
+			int from = c * cell_capacity_ + k;
+			int to = c * cellCapacity + k;
+			resized.pt_cell[to] = pt_cell[from];
+			resized.pt_map[to] = pt_map[from];
+			resized.quality[to] = quality[from];
+			resized.movement_x[to] = movement_x[from];
+			resized.movement_y[to] = movement_y[from];
+			resized.id[to] = id[from];
+		}
+		resized.counts_[c] = count;
+	}
+	*this = resized;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include "PtFeature.h"
+
+using namespace cv;
+
+/*
+Structure-of-arrays storage for the features of all cells of one map size.
+Every cell owns a fixed block of cell_capacity_ slots in the arrays, so the slot of the k:th feature
+of cell x,y is (x * NO_OF_CELLS_Y + y) * capacity + k. Only the first Count(x, y) slots of a block are used.
+Removing a feature moves the last feature of the cell to its slot, so the order inside a cell is not kept
+*/
+class FeatureStore
+{
+public:
+	//Per slot data, see PtFeature for the meaning of the fields
+	std::vector<Point> pt_cell;
+	std::vector<Point> pt_map;
+	std::vector<float> quality;
+	std::vector<float> movement_x;
+	std::vector<float> movement_y;
+	std::vector<int> id;
+
+	FeatureStore();
+	FeatureStore(int cellCapacity);
+
+	//Number of features in cell x,y
+	int Count(int x, int y) const;
+
+	//Slot of the first feature of cell x,y. The features of the cell are in slots Begin..Begin+Count-1
+	int Begin(int x, int y) const;
+
+	//Replace the features of cell x,y. Grows the capacity of all cells if the features do not fit
+	void SetCell(int x, int y, const std::vector<PtFeature> &features);
+
+	//Remove the k:th feature of cell x,y by moving the last feature of the cell in its place
+	void Remove(int x, int y, int k);
+
+	//Get the cell x,y that owns the slot
+	Point GetCell(int slot) const;
+
+	//Get the k:th feature of cell x,y as a PtFeature
+	PtFeature GetFeature(int x, int y, int k) const;
+
+	int GetCellCapacity() const;
+
+	//Bytes reserved for the feature data
+	size_t GetMemoryFootprint() const;
+
+private:
+	int cell_capacity_;
+	int counts_[NO_OF_CELLS_X * NO_OF_CELLS_Y];
+
+	int cellIndex(int x, int y) const;
+
+	//Reallocate the arrays for a new capacity, keeping the features of all cells
+	void setCapacity(int cellCapacity);
+};
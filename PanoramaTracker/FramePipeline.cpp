@@ -0,0 +1,154 @@
+#include "FramePipeline.h"
+
+FramePipeline::FramePipeline(PrepareFunction prepare, int capacity, DropPolicy policy) :
+prepare_(prepare),
+capacity_(std::max(capacity, 2)),
+policy_(policy)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		last_rot_[i] = 0;
+	}
+	velocity_[0] = velocity_[1] = 0;
+	thread_ = std::thread(&FramePipeline::run, this);
+}
+
+FramePipeline::~FramePipeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	changed_.notify_all();
+	thread_.join();
+}
+
+bool FramePipeline::Push(Mat frame, bool warpCheck)
+{
+	//Capture devices reuse their buffers, so copy before queueing
+	Frame input;
+	input.color = frame.clone();
+	input.warp_check = warpCheck;
+	input.warp_check_error = 0;
+	input.cache_hits = input.cache_misses = 0;
+	input.allocations = 0;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (policy_ == BLOCK)
+	{
+		changed_.wait(lock, [this]{ return stop_ || inFlight() < capacity_; });
+		if (stop_) return false;
+	}
+	else if (inFlight() >= capacity_)
+	{
+		dropped_++;
+		if (policy_ == DROP_NEWEST)
+		{
+			return false;
+		}
+		//Drop the oldest frame that is not being prepared
+		if (!prepared_.empty()) prepared_.pop_front();
+		else if (!pending_.empty()) pending_.pop_front();
+		else return false;
+	}
+	input.sequence = next_sequence_++;
+	pending_.push_back(input);
+	lock.unlock();
+	wake_.notify_one();
+	return true;
+}
+
+bool FramePipeline::Pop(Frame &frame)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	changed_.wait(lock, [this]{ return stop_ || !prepared_.empty() || (pending_.empty() && !running_); });
+	if (prepared_.empty()) return false;
+	frame = prepared_.front();
+	prepared_.pop_front();
+	lock.unlock();
+	changed_.notify_all();
+	return true;
+}
+
+bool FramePipeline::TryPop(Frame &frame)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (prepared_.empty()) return false;
+	frame = prepared_.front();
+	prepared_.pop_front();
+	lock.unlock();
+	changed_.notify_all();
+	return true;
+}
+
+void FramePipeline::ReportOrientation(int sequence, float x_rot, float y_rot, float z_rot, float xVelocity, float yVelocity)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	last_rot_[0] = x_rot;
+	last_rot_[1] = y_rot;
+	last_rot_[2] = z_rot;
+	velocity_[0] = xVelocity;
+	velocity_[1] = yVelocity;
+	last_sequence_ = sequence;
+	has_orientation_ = true;
+}
+
+int FramePipeline::InFlight() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return inFlight();
+}
+
+int FramePipeline::inFlight() const
+{
+	return (int)(pending_.size() + prepared_.size()) + (running_ ? 1 : 0);
+}
+
+int FramePipeline::GetCapacity() const
+{
+	return capacity_;
+}
+
+FramePipeline::DropPolicy FramePipeline::GetPolicy() const
+{
+	return policy_;
+}
+
+int FramePipeline::DroppedFrames() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dropped_;
+}
+
+void FramePipeline::predictOrientation(int sequence, float &x_rot, float &y_rot, float &z_rot) const
+{
+	int frames_ahead = has_orientation_ ? sequence - last_sequence_ : 0;
+	x_rot = last_rot_[0] + velocity_[0] * frames_ahead;
+	y_rot = last_rot_[1] + velocity_[1] * frames_ahead;
+	z_rot = last_rot_[2];
+}
+
+void FramePipeline::run()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		wake_.wait(lock, [this]{ return stop_ || !pending_.empty(); });
+		if (stop_) return;
+
+		Frame frame = pending_.front();
+		pending_.pop_front();
+		running_ = true;
+		//Predict as late as possible, so the orientations reported meanwhile are used
+		predictOrientation(frame.sequence, frame.x_rot, frame.y_rot, frame.z_rot);
+		lock.unlock();
+
+		prepare_(frame);
+
+		lock.lock();
+		running_ = false;
+		prepared_.push_back(frame);
+		changed_.notify_all();
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+using namespace cv;
+
+/*
+Two stage frame pipeline. Frames pushed to the pipeline are prepared for tracking (color conversion and
+cylindrical warp) on a background thread, while the tracker works on the previously prepared frame.
+The number of frames in flight is bounded, and the drop policy decides what happens to a new frame
+when the pipeline is full. Frames are prepared with the orientation predicted for them from the
+orientation and the motion reported by the tracker. The preparation has to use its own warper, since the warp map
+cache is not shared between threads
+*/
+class FramePipeline
+{
+public:
+	//What to do when a frame is pushed to a full pipeline
+	enum DropPolicy{ DROP_OLDEST, DROP_NEWEST, BLOCK };
+
+	//A frame prepared for tracking
+	struct Frame
+	{
+		int sequence;			//Running number of the pushed frame
+		float x_rot, y_rot, z_rot;	//Orientation the frame was warped with
+		Mat color;				//Copy of the input frame
+		Mat gray;				//Non warped grayscale frame, empty with the fused warp
+		Mat warped;
+		Mat mask;
+		Mat half;
+		Mat quarter;
+		bool warp_check;			//Compare the separable warp against the full warp when preparing
+		float warp_check_error;
+		int cache_hits, cache_misses;	//Warp map cache statistics of the preparing warper after this frame
+		long long allocations;		//Heap allocations counted while preparing, see AllocationCounter.h
+	};
+
+	//Prepares frame.color into the other fields of frame, using the orientation stored in frame
+	typedef std::function<void(Frame &frame)> PrepareFunction;
+
+	//capacity is at least 2, so that one frame can be prepared while another one is tracked
+	FramePipeline(PrepareFunction prepare, int capacity, DropPolicy policy);
+	~FramePipeline();
+
+	FramePipeline(const FramePipeline&) = delete;
+	FramePipeline &operator=(const FramePipeline&) = delete;
+
+	/*
+	Queue a frame for preparation. The frame is copied. With DROP_OLDEST a full pipeline drops its oldest frame
+	to make room. Returns false if the frame was not queued, i.e. the pipeline was full with DROP_NEWEST
+	*/
+	bool Push(Mat frame, bool warpCheck = false);
+
+	//Wait for the oldest frame in flight to be prepared and return it. Returns false if the pipeline is empty
+	bool Pop(Frame &frame);
+
+	//Return the oldest frame if it has already been prepared, without waiting
+	bool TryPop(Frame &frame);
+
+	/*
+	Report the orientation tracked for the frame with sequence, and the change of the x and y orientation per frame
+	predicted by the motion model of the tracker. The orientation of the next frames is extrapolated from them
+	*/
+	void ReportOrientation(int sequence, float x_rot, float y_rot, float z_rot, float xVelocity = 0, float yVelocity = 0);
+
+	//Number of frames pushed but not yet popped
+	int InFlight() const;
+
+	int GetCapacity() const;
+	DropPolicy GetPolicy() const;
+
+	//Number of frames dropped since the pipeline was created
+	int DroppedFrames() const;
+private:
+	void run();
+
+	//Number of frames in flight. Called with mutex_ held
+	int inFlight() const;
+
+	//Predict the orientation of the frame with sequence. Called with mutex_ held
+	void predictOrientation(int sequence, float &x_rot, float &y_rot, float &z_rot) const;
+
+	PrepareFunction prepare_;
+	int capacity_;
+	DropPolicy policy_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable changed_;
+	std::thread thread_;
+
+	bool stop_ = false;
+	bool running_ = false;
+	int next_sequence_ = 0;
+	int dropped_ = 0;
+	std::deque<Frame> pending_;
+	std::deque<Frame> prepared_;
+
+	//The last reported orientation and motion
+	bool has_orientation_ = false;
+	int last_sequence_ = 0;
+	float last_rot_[3];
+	float velocity_[2];
+};
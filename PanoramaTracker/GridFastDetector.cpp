@@ -0,0 +1,161 @@
+#include "GridFastDetector.h"
+
+//The Bresenham circle of radius 3 around the pixel, in order
+static const int circle_x[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+static const int circle_y[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+GridFastDetector::GridFastDetector(int minThreshold)
+: min_threshold_(minThreshold)
+{
+}
+
+int GridFastDetector::Detect(const Mat &image, int border, int separation, int count, std::vector<KeyPoint> &keypoints) const
+{
+	keypoints.clear();
+	//The circle needs 3 pixels around the keypoint
+	int x0 = std::max(3, border), x1 = std::min(image.cols - 4, image.cols - border);
+	int y0 = std::max(3, border), y1 = std::min(image.rows - 4, image.rows - border);
+	if (count < 1 || x0 > x1 || y0 > y1) return min_threshold_;
+
+	int circle[16];
+	for (int i = 0; i < 16; i++)
+	{
+		circle[i] = circle_y[i] * (int)image.step + circle_x[i];
+	}
+	std::vector<Corner> corners;
+	for (int y = y0; y <= y1; y++)
+	{
+		scoreRow(image.ptr<uchar>(y), y, x0, x1, circle, corners);
+	}
+
+	//Order the corners by score with a counting sort, the scores are bytes. Equal scores stay in row order
+	int offsets[256] = { 0 };
+	for (size_t i = 0; i < corners.size(); i++)
+	{
+		offsets[corners[i].score]++;
+	}
+	int position = 0;
+	for (int s = 255; s >= 0; s--)
+	{
+		int n = offsets[s];
+		offsets[s] = position;
+		position += n;
+	}
+	std::vector<Corner> ordered(corners.size());
+	for (size_t i = 0; i < corners.size(); i++)
+	{
+		ordered[offsets[corners[i].score]++] = corners[i];
+	}
+
+	//Accept the strongest corners that are far enough from the already accepted ones. The buckets are as large as the
+	//separation, so a bucket holds at most one keypoint and only the neighbouring buckets have to be checked
+	separation = std::max(separation, 1);
+	int buckets_x = image.cols / separation + 1, buckets_y = image.rows / separation + 1;
+	std::vector<int> buckets(buckets_x * buckets_y, -1);
+	int threshold = min_threshold_;
+	for (size_t i = 0; i < ordered.size() && (int)keypoints.size() < count; i++)
+	{
+		const Corner &c = ordered[i];
+		int bx = c.x / separation, by = c.y / separation;
+		bool free = true;
+		for (int ny = std::max(by - 1, 0); ny <= std::min(by + 1, buckets_y - 1) && free; ny++)
+		{
+			for (int nx = std::max(bx - 1, 0); nx <= std::min(bx + 1, buckets_x - 1); nx++)
+			{
+				int k = buckets[ny * buckets_x + nx];
+				if (k >= 0 && std::abs(keypoints[k].pt.x - c.x) < separation && std::abs(keypoints[k].pt.y - c.y) < separation)
+				{
+					free = false;
+					break;
+				}
+			}
+		}
+		if (!free) continue;
+		buckets[by * buckets_x + bx] = (int)keypoints.size();
+		keypoints.push_back(KeyPoint((float)c.x, (float)c.y, 7.f, -1, (float)c.score));
+		threshold = c.score;
+	}
+	if ((int)keypoints.size() < count) threshold = min_threshold_;
+	return threshold;
+}
+
+void GridFastDetector::scoreRow(const uchar *row, int y, int x0, int x1, const int *circle, std::vector<Corner> &corners) const
+{
+	int x = x0;
+#if CV_SIMD128
+	//16 pixels at a time. The differences saturate at zero, so the brighter and darker arcs are scored separately
+	v_uint8x16 v_min_threshold = v_setall_u8((uchar)std::min(min_threshold_, 255));
+	uchar scores[16];
+	for (; x + 15 <= x1; x += 16)
+	{
+		const uchar *p = row + x;
+		v_uint8x16 center = v_load(p);
+		v_uint8x16 brighter[16], darker[16];
+		for (int i = 0; i < 16; i++)
+		{
+			v_uint8x16 v = v_load(p + circle[i]);
+			brighter[i] = v - center;
+			darker[i] = center - v;
+		}
+		//Minimum of each arc of 9 by doubling the window: 2, 4, 8 and the ninth pixel
+		v_uint8x16 score = v_setzero_u8();
+		v_uint8x16 *diffs[2] = { brighter, darker };
+		for (int d = 0; d < 2; d++)
+		{
+			const v_uint8x16 *b = diffs[d];
+			v_uint8x16 m2[16], m4[16];
+			for (int i = 0; i < 16; i++) m2[i] = v_min(b[i], b[(i + 1) & 15]);
+			for (int i = 0; i < 16; i++) m4[i] = v_min(m2[i], m2[(i + 2) & 15]);
+			for (int i = 0; i < 16; i++)
+			{
+				v_uint8x16 m9 = v_min(v_min(m4[i], m4[(i + 4) & 15]), b[(i + 8) & 15]);
+				score = v_max(score, m9);
+			}
+		}
+		if (!v_check_any(score > v_min_threshold)) continue;
+		v_store(scores, score);
+		for (int i = 0; i < 16; i++)
+		{
+			if (scores[i] > min_threshold_)
+			{
+				Corner c = { (short)(x + i), (short)y, scores[i] };
+				corners.push_back(c);
+			}
+		}
+	}
+#endif
+	//Remaining pixels, or the whole row without SIMD support
+	for (; x <= x1; x++)
+	{
+		int score = GridFastDetector::score(row + x, circle);
+		if (score > min_threshold_)
+		{
+			Corner c = { (short)x, (short)y, (uchar)score };
+			corners.push_back(c);
+		}
+	}
+}
+
+int GridFastDetector::score(const uchar *p, const int *circle)
+{
+	int center = p[0];
+	int brighter[16], darker[16];
+	for (int i = 0; i < 16; i++)
+	{
+		int v = p[circle[i]];
+		brighter[i] = std::max(v - center, 0);
+		darker[i] = std::max(center - v, 0);
+	}
+	int score = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int b = brighter[i], d = darker[i];
+		for (int k = 1; k < 9; k++)
+		{
+			b = std::min(b, brighter[(i + k) & 15]);
+			d = std::min(d, darker[(i + k) & 15]);
+		}
+		score = std::max(score, std::max(b, d));
+	}
+	return score;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <vector>
+
+using namespace cv;
+
+/*
+FAST-9 detector for the map cells. The score of every pixel is calculated once, 16 pixels at a time with SIMD, and
+the keypoints are selected from the strongest down until the budget of the cell is full. Selecting by score
+adapts the threshold to the contents of the cell, instead of a fixed FAST threshold. A keypoint is only accepted if
+no stronger keypoint is closer than the separation, which also suppresses the non-maximums, so the support areas
+of the keypoints do not overlap
+*/
+class GridFastDetector
+{
+public:
+	//Pixels scoring minThreshold or less are never keypoints, so that flat cells do not get noise as keypoints
+	GridFastDetector(int minThreshold = 6);
+
+	/*
+	Detect up to count keypoints in the CV_8UC1 image, best first. The keypoints are at least border pixels away from the
+	edges, and their x or y distance to each other is at least separation. The response of a keypoint is its score,
+	the smallest difference to the center along its best arc of 9 pixels. Returns the adapted threshold: the score of the weakest keypoint,
+	or the minimum threshold if the budget was not filled
+	*/
+	int Detect(const Mat &image, int border, int separation, int count, std::vector<KeyPoint> &keypoints) const;
+
+private:
+	int min_threshold_;
+
+	//A pixel scoring over the minimum threshold
+	struct Corner
+	{
+		short x, y;
+		uchar score;
+	};
+
+	//Score the pixels x0..x1 of a row, adding the corners to corners
+	void scoreRow(const uchar *row, int y, int x0, int x1, const int *circle, std::vector<Corner> &corners) const;
+
+	//FAST-9 score of the pixel at p, using the offsets of the circle
+	static int score(const uchar *p, const int *circle);
+};
@@ -1,4 +1,5 @@
 #include "HelpFunctions.h"
+#include "OrderStatistics.h"
 #include <iostream>
 
 namespace HelpFunctions{
@@ -67,20 +68,8 @@ namespace HelpFunctions{
 
 	float calculateMedian(const std::vector<float>& values)
 	{
-		if (values.size() == 0) return 0;
-		else if (values.size() == 1) return values.at(0);
-		std::vector<float> sorted = values;
-		std::sort(sorted.begin(), sorted.end());
-		if (sorted.size() % 2 == 0)
-		{
-			int ind1 = sorted.size() / 2;
-			int ind2 = ind1 - 1;
-			return (sorted.at(ind1) + sorted.at(ind2)) / 2;
-		}
-		else
-		{
-			return sorted.at(ceil((float)sorted.size() / 2));
-		}
+		std::vector<float> scratch;
+		return OrderStatistics::Median(values, scratch);
 	}
 
 	float calculateStandardDeviation(const std::vector<float> &values)
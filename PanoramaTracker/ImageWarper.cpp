@@ -8,7 +8,7 @@ ImageWarper::ImageWarper() : warper(570)
 ImageWarper::ImageWarper(float warper_scale, bool use_android) : warper(warper_scale)
 {
 	Mat_<float> cameraParameters(3, 3);
-	Mat_<float> distCoeffs(1, 5);
+	Mat_<float> distCoeffs = Mat_<float>::zeros(1, 5);
 	//Logitech C920 calibration from video
 	if (!use_android){
 		//cameraParameters(0, 0) = 6.2989003437882866e+002;
@@ -87,12 +87,334 @@ Mat ImageWarper::getMask(Mat warpedImage)
 
 Mat ImageWarper::warpImageCylindrical(Mat image, float yaw, float pitch, float roll, Mat& result)
 {
-	Mat_<float> R = getRotationMatrix(yaw, pitch, roll);
-	warper.warp(image, K, R, interpolation_method_, BORDER_CONSTANT, result);
-	Mat mask = getMask(result);
+	Mat mask;
+	warpImageCylindrical(image, yaw, pitch, roll, result, mask);
 	return mask;
 }
 
+void ImageWarper::warpImageCylindrical(Mat image, float yaw, float pitch, float roll, Mat& result, Mat& mask)
+{
+	if (!use_map_cache_ && !separable_)
+	{
+		if (undistort_) image = undistortImage(image);
+		Mat_<float> R = getRotationMatrix(yaw, pitch, roll);
+		warper.warp(image, K, R, interpolation_method_, BORDER_CONSTANT, result);
+		mask = getMask(result);
+		return;
+	}
+
+	//With the cache the warp is a single lookup pass through the precomputed tables.
+	//The mask is copied, so that the caller can not modify the cached one
+	const WarpMaps &maps = getWarpMaps(image.size(), yaw, roll);
+	remap(image, result, maps.map_xy, maps.map_frac, interpolation_method_, BORDER_CONSTANT);
+	maps.mask.copyTo(mask);
+}
+
+void ImageWarper::warpColorImageCylindrical(Mat image, float yaw, float pitch, float roll, Mat& result, Mat& mask)
+{
+	if (image.channels() == 3 && (use_map_cache_ || separable_))
+	{
+		const WarpMaps &maps = getWarpMaps(image.size(), yaw, roll);
+		warpColorWithMaps(image, maps, result, mask);
+		return;
+	}
+
+	Mat gray = image;
+	if (image.channels() == 3)
+	{
+		cvtColor(image, gray_, CV_BGR2GRAY);
+		gray = gray_;
+	}
+	warpImageCylindrical(gray, yaw, pitch, roll, result, mask);
+}
+
+const short* ImageWarper::bilinearWeights()
+{
+	//Fixed point weights of the four neighbours for every fraction of the remap tables, summing exactly to 1 << remap_coef_bits_ like the ones of remap
+	static std::vector<short> table = []()
+	{
+		std::vector<short> weights(INTER_TAB_SIZE * INTER_TAB_SIZE * 4);
+		for (int fy = 0; fy < INTER_TAB_SIZE; fy++)
+		{
+			for (int fx = 0; fx < INTER_TAB_SIZE; fx++)
+			{
+				float ax = fx * (1.f / INTER_TAB_SIZE), ay = fy * (1.f / INTER_TAB_SIZE);
+				float w[4] = { (1 - ax) * (1 - ay), ax * (1 - ay), (1 - ax) * ay, ax * ay };
+				short *entry = &weights[(fy * INTER_TAB_SIZE + fx) * 4];
+				int sum = 0, largest = 0;
+				for (int k = 0; k < 4; k++)
+				{
+					entry[k] = saturate_cast<short>(w[k] * (1 << remap_coef_bits_));
+					sum += entry[k];
+					if (entry[k] > entry[largest]) largest = k;
+				}
+				entry[largest] = (short)(entry[largest] + (1 << remap_coef_bits_) - sum);
+			}
+		}
+		return weights;
+	}();
+	return &table[0];
+}
+
+void ImageWarper::warpColorWithMaps(const Mat &image, const WarpMaps &maps, Mat &result, Mat &mask) const
+{
+	/*
+	A single pass over the warped pixels. Each one reads its BGR source pixel (or the four neighbours weighted with
+	map_frac) through the cached maps, which already include the undistortion, and writes the gray value with the
+	fixed point weights cvtColor uses for CV_BGR2GRAY, together with the mask byte. Pixels outside the image read
+	as 0 like with BORDER_CONSTANT
+	*/
+	const int gray_shift = 14;
+	const int b_weight = 1868, g_weight = 9617, r_weight = 4899;
+	bool nearest = interpolation_method_ == INTER_NEAREST;
+	const short *weights = nearest ? nullptr : bilinearWeights();
+	int width = image.cols, height = image.rows;
+	result.create(maps.map_xy.rows, maps.map_xy.cols, CV_8U);
+	mask.create(maps.map_xy.rows, maps.map_xy.cols, CV_8U);
+	for (int j = 0; j < maps.map_xy.rows; j++)
+	{
+		const short *xy = maps.map_xy.ptr<short>(j);
+		const ushort *frac = nearest ? nullptr : maps.map_frac.ptr<ushort>(j);
+		const uchar *cached_mask = maps.mask.ptr<uchar>(j);
+		uchar *dst = result.ptr<uchar>(j);
+		uchar *dst_mask = mask.ptr<uchar>(j);
+		for (int i = 0; i < maps.map_xy.cols; i++)
+		{
+			int x = xy[2 * i], y = xy[2 * i + 1];
+			int bgr[3] = { 0, 0, 0 };
+			if (nearest)
+			{
+				if ((unsigned)x < (unsigned)width && (unsigned)y < (unsigned)height)
+				{
+					const uchar *p = image.ptr<uchar>(y) + x * 3;
+					bgr[0] = p[0]; bgr[1] = p[1]; bgr[2] = p[2];
+				}
+			}
+			else
+			{
+				//The channels are rounded one by one like remap does, before the gray conversion
+				const short *w = weights + frac[i] * 4;
+				int sum[3] = { 0, 0, 0 };
+				for (int k = 0; k < 4; k++)
+				{
+					int nx = x + (k & 1), ny = y + (k >> 1);
+					if ((unsigned)nx >= (unsigned)width || (unsigned)ny >= (unsigned)height) continue;
+					const uchar *p = image.ptr<uchar>(ny) + nx * 3;
+					sum[0] += p[0] * w[k]; sum[1] += p[1] * w[k]; sum[2] += p[2] * w[k];
+				}
+				for (int c = 0; c < 3; c++)
+				{
+					bgr[c] = saturate_cast<uchar>((sum[c] + (1 << (remap_coef_bits_ - 1))) >> remap_coef_bits_);
+				}
+			}
+			dst[i] = (uchar)((bgr[0] * b_weight + bgr[1] * g_weight + bgr[2] * r_weight + (1 << (gray_shift - 1))) >> gray_shift);
+			dst_mask[i] = cached_mask[i];
+		}
+	}
+}
+
+const ImageWarper::WarpMaps& ImageWarper::getWarpMaps(Size srcSize, float yaw, float roll)
+{
+	int yaw_step = cvRound(yaw / cache_angle_step_);
+	int roll_step = cvRound(roll / cache_angle_step_);
+
+	//Move a found entry to the front, so that the least recently used entry is always the last one
+	for (std::list<WarpMaps>::iterator it = map_cache_.begin(); it != map_cache_.end(); ++it)
+	{
+		if (it->yaw_step == yaw_step && it->roll_step == roll_step && it->src_size == srcSize)
+		{
+			map_cache_.splice(map_cache_.begin(), map_cache_, it);
+			cache_hits_++;
+			return map_cache_.front();
+		}
+	}
+	cache_misses_++;
+
+	//Build the maps for the quantized pose at zero pan, so that every frame hitting this entry is warped the same way
+	WarpMaps maps;
+	maps.yaw_step = yaw_step;
+	maps.roll_step = roll_step;
+	maps.src_size = srcSize;
+	Mat xmap, ymap;
+	if (separable_)
+	{
+		buildSeparableMaps(srcSize, yaw_step * cache_angle_step_, 0, roll_step * cache_angle_step_, xmap, ymap);
+	}
+	else
+	{
+		Mat_<float> R = getRotationMatrix(yaw_step * cache_angle_step_, 0, roll_step * cache_angle_step_);
+		warper.buildMaps(srcSize, K, R, xmap, ymap);
+	}
+	if (undistort_)
+	{
+		distortMaps(xmap, ymap);
+	}
+	convertMaps(xmap, ymap, maps.map_xy, maps.map_frac, CV_16SC2, interpolation_method_ == INTER_NEAREST);
+
+	if (interpolation_method_ == INTER_NEAREST)
+	{
+		maskFromMaps(maps.map_xy, srcSize, maps.mask);
+	}
+	else
+	{
+		//Warping a completely set image gives the pixels that receive data from the input image
+		Mat full(srcSize, CV_8U, Scalar(255));
+		Mat warped_full;
+		remap(full, warped_full, maps.map_xy, maps.map_frac, interpolation_method_, BORDER_CONSTANT);
+		maps.mask = getMask(warped_full);
+	}
+
+	map_cache_.push_front(maps);
+	if (map_cache_.size() > max_cached_maps_)
+	{
+		map_cache_.pop_back();
+	}
+	return map_cache_.front();
+}
+
+void ImageWarper::maskFromMaps(const Mat& mapXY, Size srcSize, Mat& mask)
+{
+	//Same values as getMask gives for a warped completely set image
+	mask.create(mapXY.rows, mapXY.cols, CV_8U);
+	for (int j = 0; j < mapXY.rows; j++)
+	{
+		const short *xy = mapXY.ptr<short>(j);
+		uchar *m = mask.ptr<uchar>(j);
+		for (int i = 0; i < mapXY.cols; i++)
+		{
+			bool inside = (unsigned)xy[2 * i] < (unsigned)srcSize.width && (unsigned)xy[2 * i + 1] < (unsigned)srcSize.height;
+			m[i] = inside ? 250 : 0;
+		}
+	}
+}
+
+Rect ImageWarper::buildSeparableMaps(Size srcSize, float yaw, float pitch, float roll, Mat& xmap, Mat& ymap)
+{
+	//The covered area of the cylinder is found from the image borders, which is cheap for the cylindrical warper
+	Rect roi = warper.warpRoi(srcSize, K, getRotationMatrix(yaw, pitch, roll));
+	float scale = warper.getScale();
+	float fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+	float yawRad = degreesToRadians(yaw), pitchRad = degreesToRadians(pitch), rollRad = degreesToRadians(roll);
+	float ct = cos(yawRad), st = sin(yawRad);
+	float c = cos(rollRad), s = sin(rollRad);
+
+	//The point (sin(u), v, cos(u)) of the cylinder is rotated back to the camera. The pan is an offset of u,
+	//and after the tilt every coordinate is a column term plus a row term: x = sin(u), y = ct*v + st*cos(u)
+	//and z = ct*cos(u) - st*v. The roll rotates x and y around the principal point
+	std::vector<float> sin_u(roi.width), cos_u(roi.width), v_row(roi.height);
+	for (int i = 0; i < roi.width; i++)
+	{
+		float u = (roi.x + i) / scale - pitchRad;
+		sin_u[i] = sin(u);
+		cos_u[i] = cos(u);
+	}
+	for (int j = 0; j < roi.height; j++)
+	{
+		v_row[j] = (roi.y + j) / scale;
+	}
+
+	xmap.create(roi.height, roi.width, CV_32F);
+	ymap.create(roi.height, roi.width, CV_32F);
+	for (int j = 0; j < roi.height; j++)
+	{
+		float *x_ptr = xmap.ptr<float>(j);
+		float *y_ptr = ymap.ptr<float>(j);
+		float y_row = ct * v_row[j], z_row = -st * v_row[j];
+		for (int i = 0; i < roi.width; i++)
+		{
+			float z = z_row + ct * cos_u[i];
+			//Points behind the camera are marked invalid the same way as the warper does
+			if (z <= 0)
+			{
+				x_ptr[i] = -1;
+				y_ptr[i] = -1;
+				continue;
+			}
+			float x = sin_u[i] / z;
+			float y = (y_row + st * cos_u[i]) / z;
+			x_ptr[i] = fx * (c * x + s * y) + cx;
+			y_ptr[i] = fy * (c * y - s * x) + cy;
+		}
+	}
+	return roi;
+}
+
+void ImageWarper::distortMaps(Mat& xmap, Mat& ymap) const
+{
+	float fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+	float k1 = dist_coeffs(0, 0), k2 = dist_coeffs(0, 1), p1 = dist_coeffs(0, 2), p2 = dist_coeffs(0, 3), k3 = dist_coeffs(0, 4);
+	for (int j = 0; j < xmap.rows; j++)
+	{
+		float *x_ptr = xmap.ptr<float>(j);
+		float *y_ptr = ymap.ptr<float>(j);
+		for (int i = 0; i < xmap.cols; i++)
+		{
+			//Points behind the camera are marked with -1 by the warper
+			if (x_ptr[i] == -1 && y_ptr[i] == -1) continue;
+
+			//Same distortion model as undistort
+			float x = (x_ptr[i] - cx) / fx;
+			float y = (y_ptr[i] - cy) / fy;
+			float r2 = x * x + y * y;
+			float radial = 1 + r2 * (k1 + r2 * (k2 + r2 * k3));
+			float x_d = x * radial + 2 * p1 * x * y + p2 * (r2 + 2 * x * x);
+			float y_d = y * radial + p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;
+			x_ptr[i] = fx * x_d + cx;
+			y_ptr[i] = fy * y_d + cy;
+		}
+	}
+}
+
+float ImageWarper::CompareSeparableWarp(Mat image, float yaw, float pitch, float roll)
+{
+	Mat reference, approximation, xmap, ymap;
+
+	//Reference warp with the full rotation
+	Mat_<float> R = getRotationMatrix(yaw, pitch, roll);
+	Point reference_tl = warper.warp(image, K, R, interpolation_method_, BORDER_CONSTANT, reference);
+
+	//Separable warp of the same pose
+	Rect roi = buildSeparableMaps(image.size(), yaw, pitch, roll, xmap, ymap);
+	remap(image, approximation, xmap, ymap, interpolation_method_, BORDER_CONSTANT);
+
+	//Align the images by their locations on the cylinder and compare the pixels that are set in both
+	Point offset = roi.tl() - reference_tl;
+	Rect in_approximation = Rect(0, 0, approximation.cols, approximation.rows) & Rect(-offset.x, -offset.y, reference.cols, reference.rows);
+	if (in_approximation.area() <= 0) return 255;
+	Rect in_reference = in_approximation + offset;
+
+	Mat diff, valid;
+	absdiff(approximation(in_approximation), reference(in_reference), diff);
+	bitwise_and(getMask(approximation)(in_approximation), getMask(reference)(in_reference), valid);
+	if (countNonZero(valid) == 0) return 255;
+	return mean(diff, valid)[0];
+}
+
+void ImageWarper::SetMapCache(bool useCache, float angleStep)
+{
+	use_map_cache_ = useCache && angleStep > 0;
+	if (angleStep > 0) cache_angle_step_ = angleStep;
+	map_cache_.clear();
+}
+
+void ImageWarper::SetSeparableWarp(bool separable)
+{
+	separable_ = separable;
+	map_cache_.clear();
+}
+
+void ImageWarper::SetUndistortion(bool undistort)
+{
+	undistort_ = undistort;
+	map_cache_.clear();
+}
+
+void ImageWarper::GetMapCacheStatistics(int& hits, int& misses) const
+{
+	hits = cache_hits_;
+	misses = cache_misses_;
+}
+
 Mat_<float> ImageWarper::getRotationMatrix(float yaw, float pitch, float roll)
 {
 	float yawRad = degreesToRadians(yaw);
@@ -132,7 +454,8 @@ Mat_<float> ImageWarper::getRotationMatrix(float yaw, float pitch, float roll)
 	rotZ(2, 1) = 0;
 	rotZ(2, 2) = 1;
 
-	rotationMatrix = rotX * rotY * rotZ;
+	//The pitch (pan around the cylinder axis) is applied last, so that it only moves the warped image along the cylinder
+	rotationMatrix = rotY * rotX * rotZ;
 
 	return rotationMatrix;
 }
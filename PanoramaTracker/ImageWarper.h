@@ -7,6 +7,7 @@
 #include <opencv2/ml/ml.hpp>
 #include <opencv2/stitching/warpers.hpp>
 #include <chrono>
+#include <list>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -19,9 +20,33 @@ class ImageWarper
 {
 private:
 
+	//Remap tables and mask of a single quantized tilt and roll, stored in fixed point format for remap
+	struct WarpMaps
+	{
+		int yaw_step;
+		int roll_step;
+		Size src_size;
+		Mat map_xy;		//CV_16SC2 integer source coordinates
+		Mat map_frac;	//CV_16UC1 interpolation table indices, empty when using INTER_NEAREST
+		Mat mask;		//Binary mask of the warped pixels that contain image data
+	};
+
 	detail::CylindricalWarper warper;
 	int interpolation_method_ = INTER_NEAREST;
 
+	//Cache of the most recently used warp maps, most recent first. An entry of a 640x480 frame takes about 1.5MB
+	static const int max_cached_maps_ = 32;
+	std::list<WarpMaps> map_cache_;
+	bool use_map_cache_ = false;
+	bool separable_ = false;
+	bool undistort_ = false;
+	float cache_angle_step_ = 0.1;
+	int cache_hits_ = 0;
+	int cache_misses_ = 0;
+
+	//Gray buffer of warpColorImageCylindrical without the maps, kept between frames so that it is not allocated again
+	Mat gray_;
+
 	Mat_<float> K;
 	Mat_<float> dist_coeffs;
 	float radiansToDegrees(float radians);
@@ -32,10 +57,67 @@ private:
 	Mat_<float> getRotationMatrix(float yaw, float pitch, float roll);
 	Mat undistortImage(Mat image);
 
+	//Get the warp maps for the pose from the cache, or build them if the pose has not been seen.
+	//The pitch (pan) only moves the warped image along the cylinder, so it is not part of the key
+	const WarpMaps& getWarpMaps(Size srcSize, float yaw, float roll);
+
+	//Warp a BGR image with the maps to a grayscale image and its mask in one pass
+	void warpColorWithMaps(const Mat &image, const WarpMaps &maps, Mat &result, Mat &mask) const;
+
+	//Bilinear fixed point weights of the four neighbours for each map_frac value, 4 per entry, with the precision remap uses
+	static const int remap_coef_bits_ = 15;
+	static const short* bilinearWeights();
+
+	//Mask of the warped pixels that receive data from the input image, found directly from the nearest neighbour maps
+	static void maskFromMaps(const Mat &mapXY, Size srcSize, Mat &mask);
+
+	/*
+	Build the maps of the separable warp. After the pan offset, every coordinate of the rotated cylinder
+	point is a per column term plus a per row term, so the maps are built from small tables with one
+	division per pixel instead of projecting every pixel. Returns the area of the cylinder covered by the maps
+	*/
+	Rect buildSeparableMaps(Size srcSize, float yaw, float pitch, float roll, Mat &xmap, Mat &ymap);
+
+	//Move the map coordinates from the undistorted image to the distorted input image using dist_coeffs
+	void distortMaps(Mat &xmap, Mat &ymap) const;
+
 public:
 	ImageWarper();
 	ImageWarper(float warper_scale, bool use_android);
 
 	//Warp image and return a binary mask_current_view_ 
 	Mat warpImageCylindrical(Mat image, float yaw, float pitch, float roll, Mat &result);
+
+	//Warp image and write its binary mask to mask. Both outputs reuse their buffers when the size does not change
+	void warpImageCylindrical(Mat image, float yaw, float pitch, float roll, Mat &result, Mat &mask);
+
+	/*
+	Warp a BGR image to a grayscale warped image and its mask. With the maps (cache or separable warp) the color
+	conversion, undistortion, warp and mask are done in a single pass, so the non warped gray image is never created.
+	Otherwise the image is converted first and warped with warpImageCylindrical
+	*/
+	void warpColorImageCylindrical(Mat image, float yaw, float pitch, float roll, Mat &result, Mat &mask);
+
+	/*
+	Toggle the warp map cache. The yaw (tilt) and roll are quantized to angleStep degrees, and the 
+	remap tables of each quantized pair are built only once. The pitch (pan) is applied last in the 
+	rotation, so it only moves the warped image and any pan hits the same entry
+	*/
+	void SetMapCache(bool useCache, float angleStep);
+
+	//Get the amount of cache hits and misses since the warper was created
+	void GetMapCacheStatistics(int &hits, int &misses) const;
+
+	/*
+	Toggle the separable warp. The maps of a new pose are built from per column and per row tables 
+	instead of the general projection of the warper, which makes the cache misses cheaper. The 
+	result is the same warp, up to the rounding of the coordinates
+	*/
+	void SetSeparableWarp(bool separable);
+
+	//Toggle the lens undistortion. With the warp maps it is folded into the maps and costs nothing per frame
+	void SetUndistortion(bool undistort);
+
+	//Warp the image with the separable and the full warp, and return the mean absolute difference of the pixels set in both
+	float CompareSeparableWarp(Mat image, float yaw, float pitch, float roll);
 };
\ No newline at end of file
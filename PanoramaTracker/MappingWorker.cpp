@@ -0,0 +1,93 @@
+#include "MappingWorker.h"
+
+MappingWorker::MappingWorker(MapFunction mapFunction, size_t maxJobs) : map_function_(mapFunction), max_jobs_(std::max(maxJobs, (size_t)1))
+{
+	thread_ = std::thread(&MappingWorker::run, this);
+}
+
+MappingWorker::~MappingWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void MappingWorker::Submit(const Job &job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (jobs_.size() >= max_jobs_)
+		{
+			jobs_.pop_front();
+			dropped_jobs_++;
+		}
+		jobs_.push_back(job);
+	}
+	wake_.notify_one();
+}
+
+bool MappingWorker::TakePublished(std::vector<CellFeatures> &completedCells, PanoramaMap &map)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (size_t i = 0; i < published_.size(); i++)
+	{
+		completedCells.push_back(std::move(published_[i]));
+	}
+	published_.clear();
+	if (!map_published_) return false;
+	map = std::move(published_map_);
+	published_map_ = PanoramaMap();
+	map_published_ = false;
+	return true;
+}
+
+void MappingWorker::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this]{ return jobs_.empty() && !running_; });
+}
+
+int MappingWorker::GetDroppedJobs()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dropped_jobs_;
+}
+
+void MappingWorker::run()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		wake_.wait(lock, [this]{ return stop_ || !jobs_.empty(); });
+		//Remaining jobs are dropped when stopping, the map is being destroyed or replaced
+		if (stop_) return;
+
+		Job job = jobs_.front();
+		jobs_.pop_front();
+		running_ = true;
+		lock.unlock();
+
+		Result result;
+		map_function_(job, result);
+
+		lock.lock();
+		for (size_t i = 0; i < result.completed_cells.size(); i++)
+		{
+			published_.push_back(std::move(result.completed_cells[i]));
+		}
+		//A newer snapshot replaces the one not taken yet, it contains everything the older one did
+		if (result.map_changed)
+		{
+			published_map_ = std::move(result.map);
+			map_published_ = true;
+		}
+		running_ = false;
+		if (jobs_.empty())
+		{
+			idle_.notify_all();
+		}
+	}
+}
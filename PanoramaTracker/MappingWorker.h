@@ -0,0 +1,96 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include "Viewpoint.h"
+#include "PtFeature.h"
+#include "PanoramaMap.h"
+
+using namespace cv;
+
+/*
+Runs the map updates on a background thread, so that integrating frames into the map and searching
+keypoints in the completed cells does not stall the tracking. Jobs are processed in submission order.
+The mapping thread writes its own copy of the map and publishes a snapshot of it with the features
+of the cells completed by each job. The tracker installs them at the start of a frame, so it never
+waits for the mapping and a cell and its features always become visible to the tracking together.
+At most maxJobs jobs wait in the queue. When it is full the oldest job is dropped: the map only takes
+pixels that are not yet set, so the pixels of the dropped frame are taken from the later frames
+*/
+class MappingWorker
+{
+public:
+	//Frame data needed to integrate a frame into the map. The images must not be shared with the tracker
+	struct Job
+	{
+		Viewpoint viewpoint;
+		Mat frame;
+		Mat view_mask;
+	};
+
+	//Features found in a newly completed cell, indexed by PtFeature::KeypointType
+	struct CellFeatures
+	{
+		Point cell;
+		std::vector<PtFeature> features[3];
+		std::vector<PtFeature> candidates;	//Keypoint candidates of the full map cell for re-seeding it
+	};
+
+	//Cells completed by a job, and a snapshot of the map if the job changed it
+	struct Result
+	{
+		std::vector<CellFeatures> completed_cells;
+		bool map_changed = false;
+		PanoramaMap map;
+	};
+
+	//Function that integrates a job into the map of the mapping thread
+	typedef std::function<void(const Job &job, Result &result)> MapFunction;
+
+	MappingWorker(MapFunction mapFunction, size_t maxJobs);
+	~MappingWorker();
+
+	MappingWorker(const MappingWorker&) = delete;
+	MappingWorker &operator=(const MappingWorker&) = delete;
+
+	//Queue a job for the mapping thread, dropping the oldest waiting job if the queue is full
+	void Submit(const Job &job);
+
+	/*
+	Move the cells published since the last call to completedCells. Returns true and the latest
+	published map snapshot in map if a map has been published since the last call
+	*/
+	bool TakePublished(std::vector<CellFeatures> &completedCells, PanoramaMap &map);
+
+	//Block until all submitted jobs are done
+	void WaitIdle();
+
+	//Number of jobs dropped because the queue was full
+	int GetDroppedJobs();
+private:
+	void run();
+
+	MapFunction map_function_;
+	size_t max_jobs_;
+
+	//Guards the job queue and the published results
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable idle_;
+	std::thread thread_;
+
+	bool stop_ = false;
+	bool running_ = false;
+	int dropped_jobs_ = 0;
+	std::deque<Job> jobs_;
+	std::vector<CellFeatures> published_;
+	bool map_published_ = false;
+	PanoramaMap published_map_;
+};
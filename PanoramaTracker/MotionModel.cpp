@@ -0,0 +1,41 @@
+#include "MotionModel.h"
+
+MotionModel::MotionModel() : MotionModel(0.5f, 0.1f)
+{
+}
+
+MotionModel::MotionModel(float alpha, float beta) :
+alpha_(alpha),
+beta_(beta)
+{
+	Reset();
+}
+
+Point2f MotionModel::Predict() const
+{
+	return velocity_ + acceleration_;
+}
+
+float MotionModel::GetUncertainty() const
+{
+	return uncertainty_;
+}
+
+void MotionModel::Update(Point2f measured)
+{
+	Point2f predicted = Predict();
+	Point2f residual = measured - predicted;
+	velocity_ = predicted + alpha_ * residual;
+	acceleration_ = acceleration_ + beta_ * residual;
+
+	//Larger of the two axes, since the search window is square
+	float error = std::max(std::abs(residual.x), std::abs(residual.y));
+	uncertainty_ = 0.8f * uncertainty_ + 0.2f * error;
+}
+
+void MotionModel::Reset()
+{
+	velocity_ = Point2f(0, 0);
+	acceleration_ = Point2f(0, 0);
+	uncertainty_ = initial_uncertainty_;
+}
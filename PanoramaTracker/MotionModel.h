@@ -0,0 +1,40 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+/*
+Alpha-beta filter on the per frame motion of the viewpoint, in full map pixels.
+Used to predict where the features are in the next frame, and how far off that prediction tends to be.
+The frame pipeline also extrapolates the orientation of the frames it prepares with the predicted motion
+*/
+class MotionModel
+{
+public:
+	MotionModel();
+	MotionModel(float alpha, float beta);
+
+	//Predicted motion of the viewpoint during the next frame
+	Point2f Predict() const;
+
+	//Typical error of the prediction in pixels, a running average of the absolute prediction errors
+	float GetUncertainty() const;
+
+	//Correct the model with the motion measured for the frame
+	void Update(Point2f measured);
+
+	//Forget the motion, e.g. after the tracking has been lost
+	void Reset();
+private:
+	float alpha_;
+	float beta_;
+
+	Point2f velocity_;
+	Point2f acceleration_;
+	float uncertainty_;
+
+	//Prediction error assumed before any motion has been measured
+	static const int initial_uncertainty_ = 8;
+};
@@ -0,0 +1,60 @@
+#include "OrderStatistics.h"
+#include <algorithm>
+#include <cmath>
+
+namespace OrderStatistics
+{
+	float Median(const std::vector<float> &values, std::vector<float> &scratch)
+	{
+		size_t n = values.size();
+		if (n == 0) return 0;
+		else if (n == 1) return values.at(0);
+		scratch.assign(values.begin(), values.end());
+
+		//Index n/2 for even and ceil(n/2) for odd counts. After nth_element everything before it is at most
+		//its value, so the lower middle value of an even count is their maximum
+		size_t upper = (n + 1) / 2;
+		std::nth_element(scratch.begin(), scratch.begin() + upper, scratch.end());
+		if (n % 2 == 0)
+		{
+			float lower = *std::max_element(scratch.begin(), scratch.begin() + upper);
+			return (scratch[upper] + lower) / 2;
+		}
+		return scratch[upper];
+	}
+
+	void FilterMovements(const std::vector<float> &x, const std::vector<float> &y, float maxDiff,
+		std::vector<float> &filteredX, std::vector<float> &filteredY, std::vector<float> &scratch, MovementStatistics &stats)
+	{
+		stats.median_x = Median(x, scratch);
+		stats.median_y = Median(y, scratch);
+
+		//Filter and sum the movements in one pass
+		filteredX.clear();
+		filteredY.clear();
+		double sum_x = 0, sum_y = 0, squares_x = 0, squares_y = 0;
+		for (size_t i = 0; i < x.size(); i++)
+		{
+			float move_x = x[i], move_y = y[i];
+			sum_x += move_x;
+			sum_y += move_y;
+			squares_x += (double)move_x * move_x;
+			squares_y += (double)move_y * move_y;
+			if (std::abs(move_x - stats.median_x) < maxDiff || std::abs(move_y - stats.median_y) < maxDiff)
+			{
+				filteredX.push_back(move_x);
+				filteredY.push_back(move_y);
+			}
+		}
+
+		//Without movements the deviation is not a number, like with HelpFunctions::calculateStandardDeviation
+		double n = (double)x.size();
+		double mean_x = sum_x / n, mean_y = sum_y / n;
+		stats.deviation_x = (float)std::sqrt(std::max(0.0, squares_x / n - mean_x * mean_x));
+		stats.deviation_y = (float)std::sqrt(std::max(0.0, squares_y / n - mean_y * mean_y));
+		if (x.empty()) stats.deviation_x = stats.deviation_y = NAN;
+
+		stats.filtered_median_x = Median(filteredX, scratch);
+		stats.filtered_median_y = Median(filteredY, scratch);
+	}
+}
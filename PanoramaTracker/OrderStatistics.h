@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+/*
+Medians and movement filtering without sorting or temporary vectors. The values are selected with nth_element
+in caller owned scratch storage, which only allocates when it has to grow.
+A counting median over the search window would not be exact, since the movements are sub-pixel
+*/
+namespace OrderStatistics
+{
+	/*
+	Median of the values, matching HelpFunctions::calculateMedian: 0 for no values, the mean of the two middle
+	values for an even count and the value above the middle (index ceil(n/2) in sorted order) for an odd count
+	*/
+	float Median(const std::vector<float> &values, std::vector<float> &scratch);
+
+	//Statistics of the x and y movements of the matched features of a map
+	struct MovementStatistics
+	{
+		float median_x, median_y;					//Medians of all movements
+		float filtered_median_x, filtered_median_y;	//Medians of the movements left after filtering
+		float deviation_x, deviation_y;				//Standard deviations of all movements
+	};
+
+	/*
+	Fused median, inlier filter and standard deviation. The movements closer than maxDiff to the median in x or y
+	are copied to filteredX and filteredY, and the deviations are accumulated in the same pass
+	*/
+	void FilterMovements(const std::vector<float> &x, const std::vector<float> &y, float maxDiff,
+		std::vector<float> &filteredX, std::vector<float> &filteredY, std::vector<float> &scratch, MovementStatistics &stats);
+}
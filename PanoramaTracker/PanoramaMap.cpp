@@ -5,40 +5,83 @@ void PanoramaMap::InitMap(Mat firstFrame, bool mapReady)
 {
 	Status(mapReady);
 	
-	//Initialize the largest map image
-	map_ = Mat(map_height_, map_width_, CV_8U, Scalar(0, 0, 0));
+	//Initialize the largest map image and its mask. No tiles are allocated yet
+	Size map_size((int)map_width_, (int)map_height_);
+	map_ = TiledImage(map_size, tile_size_, CV_8U);
+	mask_map_ = CoverageMap(map_size, tile_size_, NO_OF_CELLS_X, NO_OF_CELLS_Y);
 	
 	//Set the first frame of the map to the center of the largest map
-	firstFrame.copyTo(map_(Rect(map_.cols / 2 - firstFrame.cols / 2, map_.rows / 2 - firstFrame.rows / 2, firstFrame.cols, firstFrame.rows)));
-	
-	//Create the smaller versions of the map used for pyramidical tracking
-	resize(map_, map_half_res_, Size(map_.cols / 2, map_.rows / 2));
-	resize(map_, map_quarter_res_, Size(map_.cols / 4, map_.rows / 4));
+	Point origin(map_size.width / 2 - firstFrame.cols / 2, map_size.height / 2 - firstFrame.rows / 2);
+	map_.SetRegion(firstFrame, origin);
+	version_++;
 
 	//Create the initial mask of the map to determine which pixels are set and which aren't
-	threshold(map_, mask_map_, 0, 250, CV_THRESH_BINARY);
+	Mat first_mask;
+	threshold(firstFrame, first_mask, 0, 250, CV_THRESH_BINARY);
+	mask_map_.Add(first_mask, origin, new_spans_);
+	
+	//Create the smaller versions of the map used for pyramidical tracking
+	if (pyramidical_)
+	{
+		map_half_res_ = TiledImage(Size(map_size.width / 2, map_size.height / 2), Size(tile_size_.width / 2, tile_size_.height / 2), CV_8U);
+		map_quarter_res_ = TiledImage(Size(map_size.width / 4, map_size.height / 4), Size(tile_size_.width / 4, tile_size_.height / 4), CV_8U);
+		updatePyramids(Rect(Point(0, 0), map_size));
+	}
 }
 
-Mat PanoramaMap::getUnsetPixels(Viewpoint &currentViewpoint, Mat &currentFrame)
+const TiledImage &PanoramaMap::getTiledMap(MapSize mapSize) const
 {
-	Mat test, diff;
-	Rect vp = currentViewpoint.GetViewpoint(MAP_SIZE_FULL);
-
-	//Extract the part of the map mask that is currently inside the viewpoint
-	mask_frame_previous_ = mask_map_(vp).clone();
+	if (mapSize == MAP_SIZE_FULL || !pyramidical_)
+	{
+		return map_;
+	}
+	else if (mapSize == MAP_SIZE_HALF)
+	{
+		return map_half_res_;
+	}
+	return map_quarter_res_;
+}
 
-	//Determine the pixels that should be extracted from the current frame
-	//and set to the map
-	bitwise_or(mask_map_(vp), mask_current_view_, mask_map_(vp));
-	bitwise_xor(mask_map_(vp), mask_frame_previous_, diff);
-	return diff;
+TiledImage &PanoramaMap::getTiledMap(MapSize mapSize)
+{
+	if (mapSize == MAP_SIZE_FULL || !pyramidical_)
+	{
+		return map_;
+	}
+	else if (mapSize == MAP_SIZE_HALF)
+	{
+		return map_half_res_;
+	}
+	return map_quarter_res_;
 }
 
+void PanoramaMap::updatePyramids(const Rect &area)
+{
+	//The tiles of the smaller maps are the same tiles of the full map downscaled, so they can be resized one by one.
+	//Since the map and tile sizes are divisible by 4, every pixel of the smaller maps depends only on the pixels
+	//of its own tile, and the result is identical to resizing the whole map.
+	//Tiles that have not been allocated in the full map are black, as are their downscaled versions
+	Rect full_area = area & Rect(Point(0, 0), map_.GetSize());
+	Size tile = map_.GetTileSize();
+	for (int ty = full_area.y / tile.height; ty * tile.height < full_area.y + full_area.height; ty++)
+	{
+		for (int tx = full_area.x / tile.width; tx * tile.width < full_area.x + full_area.width; tx++)
+		{
+			if (!map_.IsAllocated(tx, ty)) continue;
+			Mat full_tile = map_.GetTile(tx, ty);
+			Mat half_tile = map_half_res_.GetTileForWrite(tx, ty);
+			Mat quarter_tile = map_quarter_res_.GetTileForWrite(tx, ty);
+			resize(full_tile, half_tile, half_tile.size());
+			resize(full_tile, quarter_tile, quarter_tile.size());
+		}
+	}
+	version_++;
+}
 
 void PanoramaMap::setUnsetInMask(Rect area)
 {
 	//Set part of the map of the mask to unset (i.e. black pixels)
-	mask_map_(area).setTo(Scalar(0, 0, 0));
+	mask_map_.Clear(area);
 }
 
 void PanoramaMap::LoopClose(float minPx, float maxPx, Size imgSize, Mat minImg, Mat maxImg)
@@ -97,64 +140,118 @@ PanoramaMap::PanoramaMap()
 	map_width_ = 0;
 	map_height_ = 0;
 	pyramidical_ = true;
+	tile_size_ = CellSize(Size(0, 0), pyramidical_);
 }
 
-PanoramaMap::PanoramaMap(float mapWidth, float mapHeight, bool pyramidical) : 
+PanoramaMap::PanoramaMap(float mapWidth, float mapHeight, bool pyramidical, Size tileSize) : 
 	map_width_(mapWidth), 
 	map_height_(mapHeight),
-	pyramidical_(pyramidical)
+	pyramidical_(pyramidical),
+	tile_size_(tileSize)
 {
 }
 
+Size PanoramaMap::CellSize(Size mapSize, bool pyramidical)
+{
+	Size cell(mapSize.width / NO_OF_CELLS_X, mapSize.height / NO_OF_CELLS_Y);
+	//With pyramids the map and the cells (i.e. the map tiles) must be divisible by 4,
+	//so that the tiles of the smaller maps are exactly the downscaled tiles of the full map
+	if (pyramidical)
+	{
+		cell.width -= cell.width % 4;
+		cell.height -= cell.height % 4;
+	}
+	return Size(std::max(cell.width, 4), std::max(cell.height, 4));
+}
+
 void PanoramaMap::UpdateMap(Viewpoint &currentViewpoint, Mat currentFrame, const std::vector<Point> &changedCells)
 {
-	//Update map based on the masks
-	//Get the unset pixels that should be set to the map from the frame
-	Mat unset_in_frame = getUnsetPixels(currentViewpoint, currentFrame);
-	Mat pixels_in_mask;
-	
-	//Get the pixels from the frame to pixels_in_mask_ according to the unset_in_frame mask
-	currentFrame.copyTo(pixels_in_mask, unset_in_frame);
+	UpdateMap(currentViewpoint, currentFrame, mask_current_view_, changedCells);
+}
 
-	//Set the found pixels in to the map_
-	pixels_in_mask.copyTo(map_(currentViewpoint.GetViewpoint(MAP_SIZE_FULL)), unset_in_frame);
+void PanoramaMap::UpdateMap(Viewpoint &currentViewpoint, Mat currentFrame, const Mat &viewMask, const std::vector<Point> &changedCells)
+{
+	//Set the pixels of the current view that are not yet set in the map mask, getting them as spans of map rows
+	Rect vp = currentViewpoint.GetViewpoint(MAP_SIZE_FULL);
+	mask_map_.Add(viewMask, vp.tl(), new_spans_);
+
+	//Copy only the new pixels from the frame to the map tiles
+	int x_min = map_.GetSize().width, x_max = 0;
+	for (size_t i = 0; i < new_spans_.size(); i++)
+	{
+		const CoverageMap::Span &span = new_spans_[i];
+		map_.SetRow(currentFrame.ptr<uchar>(span.y - vp.y) + (span.x_begin - vp.x), Point(span.x_begin, span.y), span.x_end - span.x_begin);
+		x_min = std::min(x_min, span.x_begin);
+		x_max = std::max(x_max, span.x_end);
+	}
+	if (!new_spans_.empty())
+	{
+		//The spans are in row order, so the rows of the written area are those of the first and last span
+		Rect written(x_min, new_spans_.front().y, x_max - x_min, new_spans_.back().y + 1 - new_spans_.front().y);
+		pyramid_dirty_area_ = pyramid_dirty_area_.area() > 0 ? (pyramid_dirty_area_ | written) : written;
+		version_++;
+	}
+	for (size_t i = 0; i < changedCells.size(); i++)
+	{
+		Rect cell(changedCells.at(i).x * tile_size_.width, changedCells.at(i).y * tile_size_.height, tile_size_.width, tile_size_.height);
+		pyramid_dirty_area_ = pyramid_dirty_area_.area() > 0 ? (pyramid_dirty_area_ | cell) : cell;
+	}
 	
 	//Since resizing is an expensive operation, dont update the smaller maps every frame.
-	//Only update them whenever some cell is completely filled
-	if (pyramidical_ && changedCells.size() > 0 || update_smaller_){
-		resize(map_, map_half_res_, Size(map_.cols / 2, map_.rows / 2));
-		resize(map_, map_quarter_res_, Size(map_.cols / 4, map_.rows / 4));
-		update_smaller_ = false;
+	//Only update them whenever some cell is completely filled, and then only the area written since the last update
+	if (pyramidical_ && (changedCells.size() > 0 || update_smaller_)){
+		updatePyramids(pyramid_dirty_area_);
+		pyramid_dirty_area_ = Rect();
 	}
+	update_smaller_ = false;
 }
 
 Mat PanoramaMap::GetMap(MapSize mapSize) const
 {
-	if (mapSize == MAP_SIZE_FULL || !pyramidical_)
-	{
-		return map_;
-	}
-	else if (mapSize == MAP_SIZE_HALF)
-	{
-		return map_half_res_;
-	}
-		return map_quarter_res_;
+	return getTiledMap(mapSize).ToMat();
+}
+
+Mat PanoramaMap::GetRegion(const Rect &area, MapSize mapSize) const
+{
+	return getTiledMap(mapSize).GetRegion(area);
+}
+
+const CoverageMap &PanoramaMap::GetCoverage() const
+{
+	return mask_map_;
+}
+
+void PanoramaMap::SwapContent(PanoramaMap &other)
+{
+	std::swap(map_, other.map_);
+	std::swap(map_half_res_, other.map_half_res_);
+	std::swap(map_quarter_res_, other.map_quarter_res_);
+	std::swap(mask_map_, other.mask_map_);
+	std::swap(version_, other.version_);
 }
 
 void PanoramaMap::SetMap(Mat map, MapSize mapSize)
 {
-	if (mapSize == MAP_SIZE_FULL || !pyramidical_)
+	//A map without a size takes it from the full sized map
+	if (map_width_ == 0 && mapSize == MAP_SIZE_FULL)
 	{
-		map_ = map.clone();
-	}
-	else if (mapSize == MAP_SIZE_HALF)
-	{
-		map_half_res_ = map.clone();
-	}
-	else
-	{
-		map_quarter_res_ = map.clone();
+		map_width_ = map.cols;
+		map_height_ = map.rows;
+		tile_size_ = CellSize(map.size(), pyramidical_);
 	}
+	//The tiles of the smaller maps are the tiles of the full map downscaled
+	int f = mapSize == MAP_SIZE_FULL ? 1 : (mapSize == MAP_SIZE_HALF ? 2 : 4);
+	Size tile_size(std::max(tile_size_.width / f, 1), std::max(tile_size_.height / f, 1));
+	TiledImage &tiled = getTiledMap(mapSize);
+	tiled = TiledImage(map.size(), tile_size, map.type());
+	tiled.SetRegion(map, Point(0, 0));
+	version_++;
+}
+
+size_t PanoramaMap::GetMemoryFootprint() const
+{
+	return map_.GetMemoryFootprint() + map_half_res_.GetMemoryFootprint()
+		+ map_quarter_res_.GetMemoryFootprint() + mask_map_.GetMemoryFootprint();
 }
 
 bool PanoramaMap::Status() const
@@ -175,11 +272,7 @@ Mat PanoramaMap::GetMask(MaskType maskType) const
 	{
 		return mask_current_view_;
 	}
-	if (maskType == MASK_MAP)
-	{
-		return mask_map_;
-	}
-	return mask_frame_previous_;
+	return mask_map_.ToMat();
 }
 
 void PanoramaMap::SetMask(MaskType maskType, const Mat &new_mask)
@@ -190,11 +283,14 @@ void PanoramaMap::SetMask(MaskType maskType, const Mat &new_mask)
 	}
 	else if (maskType == MASK_MAP)
 	{
-		mask_map_ = new_mask;
-	}
-	else
-	{
-		mask_frame_previous_ = new_mask;
+		if (map_width_ == 0)
+		{
+			map_width_ = new_mask.cols;
+			map_height_ = new_mask.rows;
+			tile_size_ = CellSize(new_mask.size(), pyramidical_);
+		}
+		mask_map_ = CoverageMap(new_mask.size(), tile_size_, NO_OF_CELLS_X, NO_OF_CELLS_Y);
+		mask_map_.Add(new_mask, Point(0, 0), new_spans_);
 	}
 }
 
@@ -208,9 +304,19 @@ float PanoramaMap::GetWidth() const
 	return map_width_;
 }
 
+Size PanoramaMap::GetTileSize() const
+{
+	return tile_size_;
+}
+
+int PanoramaMap::GetVersion() const
+{
+	return version_;
+}
+
 void PanoramaMap::UpdateColumn(const Rect &area)
 {
-	mask_map_(area).setTo(Scalar(0, 0, 0));
+	mask_map_.Clear(area);
 	//Also force the update of smaller versions of the map
 	update_smaller_ = true;
 }
\ No newline at end of file
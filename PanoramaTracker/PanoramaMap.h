@@ -9,13 +9,15 @@
 #include <opencv2/features2d/features2d.hpp>
 #include <chrono>
 #include "Viewpoint.h"
+#include "TiledImage.h"
+#include "CoverageMap.h"
 #define NO_OF_CELLS_X 64
 #define NO_OF_CELLS_Y 18
 using namespace cv;
 
 /*
 Class that holds all the information about the panoramic map(s) used for the tracking
-The pyramidic method for tracking is currently deprecated!
+The pyramidic method for tracking is currently deprecated, unless used as coarse to fine tracking (PT_COARSE_TO_FINE)!
 */
 class PanoramaMap
 {
@@ -24,10 +26,13 @@ private:
 	float map_width_;
 	float map_height_;
 
-	//Map and its down scaled versions for pyramidic tracking
-	Mat map_;
-	Mat map_half_res_;
-	Mat map_quarter_res_;
+	//Size of the tiles of the full sized map, same as the size of the cells
+	Size tile_size_;
+
+	//Map and its down scaled versions for pyramidic tracking, stored as tiles that are allocated when first written
+	TiledImage map_;
+	TiledImage map_half_res_;
+	TiledImage map_quarter_res_;
 
 	/*
 	A binary mask_current_view_ showing the current viewpoint of the camera.
@@ -37,11 +42,11 @@ private:
 	*/
 	Mat mask_current_view_;
 
-	//A binary mask that containts all the pixels that are already mapped
-	Mat mask_map_;
+	//A binary mask that containts all the pixels that are already mapped, one bit per pixel
+	CoverageMap mask_map_;
 
-	//The mask from the previous frame
-	Mat mask_frame_previous_;
+	//Pixels set to the map by the latest update, kept so that updating does not allocate
+	std::vector<CoverageMap::Span> new_spans_;
 
 	//Was used for loading/saving of maps
 	bool map_ready_ = false;
@@ -57,16 +62,29 @@ private:
 	int max_x_jump_;
 	bool update_smaller_ = false;
 
-	//Get the mask containing all unset pixels using the current viewpoint
-	Mat getUnsetPixels(Viewpoint &currentViewpoint, Mat &currentFrame);
+	//Area of the full map written since the smaller maps were last updated
+	Rect pyramid_dirty_area_;
+
+	//Incremented whenever the map images change, so that the views of the map can be cached
+	int version_ = 0;
+
+	//Get the tiled image of the requested map size
+	const TiledImage &getTiledMap(MapSize mapSize) const;
+	TiledImage &getTiledMap(MapSize mapSize);
+
+	//Downscale the tiles of the full map touching area to the smaller maps
+	void updatePyramids(const Rect &area);
 
 public:
-	//Whether the handled mask is the one from current frame, one of the whole map or of previous frame
-	enum MaskType{MASK_CURRENT, MASK_MAP, MASK_MAP_PREV};
+	//Whether the handled mask is the one from current frame or the one of the whole map
+	enum MaskType{MASK_CURRENT, MASK_MAP};
 
-	//Constructors
+	//Constructors. A default constructed map gets its size from the first map or mask set to it
 	PanoramaMap();
-	PanoramaMap(float mapWidth, float mapHeight, bool pyramidical);
+	PanoramaMap(float mapWidth, float mapHeight, bool pyramidical, Size tileSize);
+
+	//Size of the cells, i.e. the tiles, of a map of mapSize. Divisible by 4 with pyramids, and never smaller than 4x4
+	static Size CellSize(Size mapSize, bool pyramidical);
 	
 	//Initialize the map when tracking begins
 	void InitMap(Mat firstFrame, bool mapReady);
@@ -76,10 +94,28 @@ public:
 	update the smaller versions of the map without requiring so much resize operations
 	*/
 	void UpdateMap(Viewpoint &currentViewpoint, Mat currentFrame, const std::vector<Point> &changedCells);
+
+	//Update map using viewMask instead of the current view mask, for updates that run behind the tracking
+	void UpdateMap(Viewpoint &currentViewpoint, Mat currentFrame, const Mat &viewMask, const std::vector<Point> &changedCells);
 	
-	//Get the image of the requested map size
+	//Get the image of the requested map size. Assembles the whole map from the tiles, so it should not be used every frame
 	Mat GetMap(MapSize mapSize) const;
 
+	//Get an area of the map of the requested map size. Areas inside a single tile, e.g. cells, are returned without copying
+	Mat GetRegion(const Rect &area, MapSize mapSize) const;
+
+	//Get the coverage of the map, which also knows if the cells are complete
+	const CoverageMap &GetCoverage() const;
+
+	//Bytes used by the allocated tiles of the maps and the mask
+	size_t GetMemoryFootprint() const;
+
+	/*
+	Exchange the map images and the coverage with other, keeping the rest of the state. Used to take the map
+	published by the mapping thread into use
+	*/
+	void SwapContent(PanoramaMap &other);
+
 	//Set a custom image to be used as the map
 	void SetMap(Mat map, MapSize mapSize);
 
@@ -94,6 +130,12 @@ public:
 	//Get (full) map dimensions
 	float GetHeight() const;
 	float GetWidth() const;
+
+	//Size of the tiles of the full map
+	Size GetTileSize() const;
+
+	//Changes whenever the map images change
+	int GetVersion() const;
 	
 	/*
 	Update a single column of cells in the map. Used for updating a part 
@@ -13,30 +13,50 @@ PanoramaTracker::PanoramaTracker(PtSettings settings) : tracker_settings(setting
 	construct();
 }
 
+PanoramaTracker::~PanoramaTracker()
+{
+	frame_pipeline_.reset();
+	mapping_worker_.reset();
+}
+
 void PanoramaTracker::construct(){
 	tracker_settings.Set(PT_CELLS_X, NO_OF_CELLS_X);
 	tracker_settings.Set(PT_CELLS_Y, NO_OF_CELLS_Y);
+	initWarper();
+	relocalizer = Relocalizer();
+	for (int i = 0; i < 3; i++) search_size_override_[i] = 0;
+}
+
+void PanoramaTracker::initWarper()
+{
 	bool android; tracker_settings.Get(PT_USE_ANDROID_SHIELD, android);
 	int warper_scale; tracker_settings.Get(PT_WARPER_SCALE, warper_scale);
+	bool warp_cache; tracker_settings.Get(PT_USE_WARP_CACHE, warp_cache);
+	float warp_cache_step; tracker_settings.Get(PT_WARP_CACHE_STEP, warp_cache_step);
+	bool separable; tracker_settings.Get(PT_SEPARABLE_WARP, separable);
+	bool undistort; tracker_settings.Get(PT_UNDISTORT, undistort);
 	warper_ = ImageWarper(warper_scale, android);
-	relocalizer = Relocalizer();
+	warper_.SetMapCache(warp_cache, warp_cache_step);
+	warper_.SetSeparableWarp(separable);
+	warper_.SetUndistortion(undistort);
+	pipeline_warper_ = warper_;
 }
 
 void PanoramaTracker::InitializeMap(Mat frame, bool mapReady, bool mapLoaded)
 {
+	//Stop the background threads working on the previous map before replacing it
+	frame_pipeline_.reset();
+	mapping_worker_.reset();
+
 	Mat gray, warped, mask_curr_view;
 	float img_w, img_h;
 	float s = (float)map_vertical_degrees_ / 360.0;
-	bool android;
-	int warper_scale;
 	int camera_fov_h, camera_fov_v;
 	int cell_width, cell_height;
 
 
 	//Initialize the warper object and warp the frame
-	tracker_settings.Get(PT_USE_ANDROID_SHIELD, android);
-	tracker_settings.Get(PT_WARPER_SCALE, warper_scale);
-	warper_ = ImageWarper(warper_scale, android);
+	initWarper();
 	cvtColor(frame, gray, CV_BGR2GRAY);
 	mask_curr_view = warper_.warpImageCylindrical(gray, -y_rotation_, 0, z_rotation_, warped);
 
@@ -72,19 +92,27 @@ void PanoramaTracker::InitializeMap(Mat frame, bool mapReady, bool mapLoaded)
 	//(Loading old maps is currently deprecated)
 	if (!mapLoaded)
 	{
-		panorama_map = PanoramaMap(map_width, map_height, pyr);
+		//With pyramids the map must be divisible by 4, like its cells
+		if (pyr)
+		{
+			map_width -= map_width % 4;
+			map_height -= map_height % 4;
+		}
+		Size cell_size = PanoramaMap::CellSize(Size(map_width, map_height), pyr);
+		cell_width = cell_size.width;
+		cell_height = cell_size.height;
+		panorama_map = PanoramaMap(map_width, map_height, pyr, cell_size);
 		panorama_map.SetMask(PanoramaMap::MASK_CURRENT, mask_curr_view);
 		panorama_map.InitMap(warped, mapReady);
-		cell_width = ceil(map_width / NO_OF_CELLS_X);
-		cell_height = ceil(map_height / NO_OF_CELLS_Y);
 	}
 	else
 	{
-		Mat full_map = panorama_map.GetMap(MAP_SIZE_FULL);
-		cell_width = ceil(full_map.cols / NO_OF_CELLS_X);
-		cell_height = ceil(full_map.rows / NO_OF_CELLS_Y);
+		//The cells of a loaded map are its tiles
+		cell_width = panorama_map.GetTileSize().width;
+		cell_height = panorama_map.GetTileSize().height;
 	}
-	cell_manager_ = CellManager(cell_width, cell_height);
+	int max_kp; tracker_settings.Get(PT_MAX_KEYPOINTS_PER_CELL, max_kp);
+	cell_manager_ = CellManager(cell_width, cell_height, max_kp);
 	std::cout << "Initialized map size: " << map_width << "," << map_height << " with image resolution " << img_w << "," << img_h << std::endl;
 	
 	//Initialize the viewpoint object
@@ -95,25 +123,26 @@ void PanoramaTracker::InitializeMap(Mat frame, bool mapReady, bool mapLoaded)
 	}
 	else
 	{
-		Mat full_map = panorama_map.GetMap(MAP_SIZE_FULL);
-		orientation_pixels_x = full_map.cols / 2;
-		orientation_pixels_y = full_map.rows / 2;
+		orientation_pixels_x = (int)panorama_map.GetWidth() / 2;
+		orientation_pixels_y = (int)panorama_map.GetHeight() / 2;
 	}
 	viewpoint_ = Viewpoint(orientation_pixels_x - mask_curr_view.cols / 2, orientation_pixels_y - mask_curr_view.rows / 2,
 		mask_curr_view.cols, mask_curr_view.rows);
+	updateVisibleCells();
 
 	//Check which cells are completely filled after initialization, and search for keypoints in them
-	Mat mapMask = panorama_map.GetMask(PanoramaMap::MASK_MAP);
 	for (int i = 0; i < NO_OF_CELLS_X; i++)
 	{
 		for (int j = 0; j < NO_OF_CELLS_Y; j++)
 		{
-			cell_manager_.UpdateCellStatus(i, j, mapMask);
+			cell_manager_.UpdateCellStatus(i, j, panorama_map.GetCoverage());
 			//If cell has been filled and map is not loaded using mapmanager
 			if (cell_manager_.Status(i,j) && !mapLoaded){
 				getKeypoints(i, j, MAP_SIZE_FULL);
-				getKeypoints(i, j, MAP_SIZE_QUARTER);
-				getKeypoints(i, j, MAP_SIZE_HALF);
+				if (pyr){
+					getKeypoints(i, j, MAP_SIZE_QUARTER);
+					getKeypoints(i, j, MAP_SIZE_HALF);
+				}
 			}
 		}
 	}
@@ -122,62 +151,164 @@ void PanoramaTracker::InitializeMap(Mat frame, bool mapReady, bool mapLoaded)
 
 void PanoramaTracker::updateCurrentFrame(Mat frame)
 {
-	Mat gray, warped;
+	//The color frame is only read during this call (getNonWarpedFrame), so a header is enough. The pipeline copies
+	//on Push, because it keeps the frame while the caller's buffer is reused
+	serial_frame_.color = frame;
+	serial_frame_.x_rot = x_rotation_;
+	serial_frame_.y_rot = y_rotation_;
+	serial_frame_.z_rot = z_rotation_;
+	serial_frame_.warp_check = debug_warp_check;
+	prepareFrame(serial_frame_, warper_, &debug_timer_);
+	installFrame(serial_frame_);
+}
 
-	debug_timer_.StartTimer("cvtColor in updateCurrentFrame");
-	cvtColor(frame, gray, CV_BGR2GRAY);
-	debug_timer_.StopTimer("cvtColor in updateCurrentFrame");
+void PanoramaTracker::prepareFrame(FramePipeline::Frame &frame, ImageWarper &warper, DebugTimer *timer)
+{
+	bool fused; tracker_settings.Get(PT_FUSED_WARP, fused);
+
+	if (fused)
+	{
+		//Color conversion and warping in one pass. The non warped gray frame is only created when needed
+		frame.gray.release();
+		if (timer) timer->StartTimer("warper.warpColorImageCylindrical");
+		warper.warpColorImageCylindrical(frame.color, -frame.y_rot, frame.x_rot, frame.z_rot, frame.warped, frame.mask);
+		if (timer) timer->StopTimer("warper.warpColorImageCylindrical");
+	}
+	else
+	{
+		if (timer) timer->StartTimer("cvtColor in updateCurrentFrame");
+		cvtColor(frame.color, frame.gray, CV_BGR2GRAY);
+		if (timer) timer->StopTimer("cvtColor in updateCurrentFrame");
+
+		if (timer) timer->StartTimer("warper.warpImageCylindrical");
+		warper.warpImageCylindrical(frame.gray, -frame.y_rot, frame.x_rot, frame.z_rot, frame.warped, frame.mask);
+		if (timer) timer->StopTimer("warper.warpImageCylindrical");
+	}
 
-	//Is the non warped frame necessary?? One extra clone...
-	current_frame_non_warped_ = gray.clone();
+	//Compare the separable warp against the full warp for the current pose
+	frame.warp_check_error = 0;
+	if (frame.warp_check)
+	{
+		Mat gray = frame.gray;
+		if (gray.empty()) cvtColor(frame.color, gray, CV_BGR2GRAY);
+		frame.warp_check_error = warper.CompareSeparableWarp(gray, -frame.y_rot, frame.x_rot, frame.z_rot);
+	}
 
-	debug_timer_.StartTimer("warper.warpImageCylindrical");
-	Mat mask_curr_frame = warper_.warpImageCylindrical(gray, -y_rotation_, x_rotation_, z_rotation_, warped);
-	debug_timer_.StopTimer("warper.warpImageCylindrical");
+	warper.GetMapCacheStatistics(frame.cache_hits, frame.cache_misses);
 
-	panorama_map.SetMask(PanoramaMap::MASK_CURRENT, mask_curr_frame);
-	viewpoint_.UpdateViewpointSize(mask_curr_frame.cols, mask_curr_frame.rows, panorama_map.GetWidth(), panorama_map.GetHeight());
-	current_frame_ = warped;
 	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
 	if (pyr){
-		resize(current_frame_, current_frame_half_, Size(current_frame_.cols / 2, current_frame_.rows / 2));
-		resize(current_frame_, current_frame_quarter_, Size(current_frame_.cols / 4, current_frame_.rows / 4));
+		resize(frame.warped, frame.half, Size(frame.warped.cols / 2, frame.warped.rows / 2));
+		resize(frame.warped, frame.quarter, Size(frame.warped.cols / 4, frame.warped.rows / 4));
 	}
 }
 
+void PanoramaTracker::installFrame(const FramePipeline::Frame &frame)
+{
+	current_frame_color_ = frame.color;
+	current_frame_non_warped_ = frame.gray;
+	if (frame.warp_check)
+	{
+		warp_check_error_ = frame.warp_check_error;
+	}
+	warp_cache_hits_ = frame.cache_hits;
+	warp_cache_misses_ = frame.cache_misses;
+
+	panorama_map.SetMask(PanoramaMap::MASK_CURRENT, frame.mask);
+	viewpoint_.UpdateViewpointSize(frame.mask.cols, frame.mask.rows, panorama_map.GetWidth(), panorama_map.GetHeight());
+	updateVisibleCells();
+	current_frame_ = frame.warped;
+	current_frame_half_ = frame.half;
+	current_frame_quarter_ = frame.quarter;
+}
+
+Mat PanoramaTracker::getNonWarpedFrame()
+{
+	if (current_frame_non_warped_.empty() && !current_frame_color_.empty())
+	{
+		cvtColor(current_frame_color_, current_frame_non_warped_, CV_BGR2GRAY);
+	}
+	return current_frame_non_warped_;
+}
+
 Mat PanoramaTracker::ViewMap(MapSize mapSize, bool drawCells, bool drawKeypoints, bool showViewpoint, bool moveMap, bool onlyGet) const
 {
 	int ch = cell_manager_.GetCellHeight(mapSize);
 	int cw = cell_manager_.GetCellWidth(mapSize);
-	Mat map_colored;
-	cvtColor(panorama_map.GetMap(mapSize), map_colored, CV_GRAY2BGR);
-	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
-	Mat map_clone = map_colored.clone();
+	int f;
+	if (mapSize == MAP_SIZE_FULL)
+	{
+		f = 1;
+	}
+	else if (mapSize == MAP_SIZE_HALF)
+	{
+		f = 2;
+	}
+	else
+	{
+		f = 4;
+	}
+	Rect whole_map(0, 0, (int)panorama_map.GetWidth() / f, (int)panorama_map.GetHeight() / f);
+
+	//Cut the map to the required size before reading it, so that only the shown part is assembled from the tiles
+	Rect visible_map = whole_map;
+	if (moveMap){
+		int h = panorama_map.GetHeight() / f;
+		int w = map_view_pixels_ / f;
+		int x = (viewpoint_.x / f + (viewpoint_.width / 2) / f - (w / 2));
+		if (x < 0) x = 0;
+		if (x + w > panorama_map.GetWidth() / f){
+			x = panorama_map.GetWidth() / f - map_view_pixels_ / f;
+		}
+		visible_map = Rect(x, 0, w, h) & whole_map;
+	}
+
+	Mat shown;
+	if (moveMap)
+	{
+		cvtColor(panorama_map.GetRegion(visible_map, mapSize), shown, CV_GRAY2BGR);
+	}
+	else
+	{
+		//The whole map is assembled and colored only when it has changed
+		if (view_map_cache_.empty() || view_map_cache_size_ != mapSize || view_map_cache_version_ != panorama_map.GetVersion())
+		{
+			cvtColor(panorama_map.GetMap(mapSize), view_map_cache_, CV_GRAY2BGR);
+			view_map_cache_size_ = mapSize;
+			view_map_cache_version_ = panorama_map.GetVersion();
+		}
+		view_map_cache_.copyTo(shown);
+	}
+	Point offset = visible_map.tl();
+
 	if (drawCells)
 	{
 		//Draw vertical lines
 		for (int i = 0; i < NO_OF_CELLS_X; i++)
 		{
-			line(map_clone, Point(i*cw, 0), Point(i*cw, map_colored.rows), Scalar(255, 255, 255), 1);
+			line(shown, Point(i*cw - offset.x, 0), Point(i*cw - offset.x, shown.rows), Scalar(255, 255, 255), 1);
 		}
 		//Draw horizontal lines
 		for (int i = 0; i < NO_OF_CELLS_Y; i++)
 		{
-			line(map_clone, Point(0, i*ch), Point(map_colored.cols, i*ch), Scalar(255, 255, 255), 1);
+			line(shown, Point(0, i*ch - offset.y), Point(shown.cols, i*ch - offset.y), Scalar(255, 255, 255), 1);
 		}
 	}
 	if (drawKeypoints)
 	{
+		PtFeature::KeypointType kp_type = PtFeature::KP_QUARTER_MAP;
+		if (mapSize == MAP_SIZE_FULL) kp_type = PtFeature::KP_FULL_MAP;
+		else if (mapSize == MAP_SIZE_HALF) kp_type = PtFeature::KP_HALF_MAP;
+		const FeatureStore &store = cell_manager_.GetFeatureStore(kp_type);
 		for (int i = 0; i < NO_OF_CELLS_X; i++)
 		{
+			//Skip the columns of cells outside the shown part
+			if ((i + 1) * cw <= visible_map.x || i * cw >= visible_map.x + visible_map.width) continue;
 			for (int j = 0; j < NO_OF_CELLS_Y; j++)
 			{
-				std::vector<PtFeature> keypoints;
-				if(mapSize==MAP_SIZE_FULL)keypoints = cell_manager_.GetCellKeypoints(i, j, PtFeature::KP_FULL_MAP);
-				else if (mapSize == MAP_SIZE_HALF )keypoints = cell_manager_.GetCellKeypoints(i, j, PtFeature::KP_HALF_MAP);
-				else keypoints = cell_manager_.GetCellKeypoints(i, j, PtFeature::KP_QUARTER_MAP);
-				for (size_t k = 0; k < keypoints.size(); k++){
-					circle(map_clone, Point(keypoints.at(k).pt_map),
+				int begin = store.Begin(i, j);
+				for (int k = 0; k < store.Count(i, j); k++){
+					circle(shown, store.pt_map[begin + k] - offset,
 						3, Scalar(0, 255, 0), 1);
 				}
 			}
@@ -185,40 +316,9 @@ Mat PanoramaTracker::ViewMap(MapSize mapSize, bool drawCells, bool drawKeypoints
 	}
 
 	if (showViewpoint){
-		viewpoint_.DrawViewpoint(map_clone, mapSize);
+		viewpoint_.DrawViewpoint(shown, mapSize, offset);
 	}
 
-	//Cut the map to the required size
-	Mat shown;
-	if (moveMap){
-		int f;
-		int h, w;
-		if (mapSize == MAP_SIZE_FULL)
-		{
-			f = 1;
-		}
-		else if (mapSize == MAP_SIZE_HALF)
-		{
-			f = 2;
-		}
-		else
-		{
-			f = 4;
-		}
-		h = panorama_map.GetHeight() / f;
-		w = map_view_pixels_ / f;
-		int x = (viewpoint_.x / f + (viewpoint_.width / 2) / f - (w / 2));
-		if (x < 0) x = 0;
-		if (x + w > panorama_map.GetWidth() / f){
-			x = panorama_map.GetWidth() / f - map_view_pixels_ / f;
-		}
-		Rect visibleMap = Rect(x, 0, w, h);
-		shown = map_clone(visibleMap);
-	}
-	else
-	{
-		shown = map_clone;
-	}
 	//Draw orientation texts
 	std::ostringstream oss;
 	oss << "Orientation x: " << x_rotation_ << ", Orientation y: " << y_rotation_ << ", Rotation: " << z_rotation_;
@@ -234,11 +334,7 @@ Mat PanoramaTracker::GetMapImage() const
 {
 	int f = 1;	//Full map 1, half map 2, quarter map 4
 	int h, w;
-	Mat map = panorama_map.GetMap(MAP_SIZE_FULL);
 	Mat colored, resized; 
-	//"Color" the map in order to draw the viewpoint as a colored rect
-	cvtColor(map, colored, CV_GRAY2BGR);
-	viewpoint_.DrawViewpoint(colored, MAP_SIZE_FULL);
 
 	//Calculate the part of the map that should be currently visible
 	h = panorama_map.GetHeight() / f;
@@ -249,7 +345,11 @@ Mat PanoramaTracker::GetMapImage() const
 		x = panorama_map.GetWidth() / f - map_view_pixels_ / f;
 	}
 	Rect visibleMap = Rect(x, 0, w, h);
-	Mat shown = colored(visibleMap);
+
+	//Only the visible part is read from the map tiles. "Color" it in order to draw the viewpoint as a colored rect
+	cvtColor(panorama_map.GetRegion(visibleMap, MAP_SIZE_FULL), colored, CV_GRAY2BGR);
+	viewpoint_.DrawViewpoint(colored, MAP_SIZE_FULL, visibleMap.tl());
+	Mat shown = colored;
 	//The map shown in the Unity3D Application doesn't need to be very large
 	resize(shown, resized, Size(shown.cols / 4, shown.rows / 4));
 	//Viewpoint in the middle of the map
@@ -259,11 +359,7 @@ Mat PanoramaTracker::GetMapImage() const
 Mat PanoramaTracker::GetMapImage(Size size) const{
 	int f = 1;	//Full map 1, half map 2, quarter map 4
 	int h, w;
-	Mat map = panorama_map.GetMap(MAP_SIZE_FULL);
 	Mat colored, resized;
-	//"Color" the map in order to draw the viewpoint as a colored rect
-	cvtColor(map, colored, CV_GRAY2BGR);
-	viewpoint_.DrawViewpoint(colored, MAP_SIZE_FULL);
 
 	//Calculate the part of the map that should be currently visible
 	h = panorama_map.GetHeight() / f;
@@ -274,7 +370,11 @@ Mat PanoramaTracker::GetMapImage(Size size) const{
 		x = panorama_map.GetWidth() / f - map_view_pixels_ / f;
 	}
 	Rect visibleMap = Rect(x, 0, w, h);
-	Mat shown = colored(visibleMap);
+
+	//Only the visible part is read from the map tiles. "Color" it in order to draw the viewpoint as a colored rect
+	cvtColor(panorama_map.GetRegion(visibleMap, MAP_SIZE_FULL), colored, CV_GRAY2BGR);
+	viewpoint_.DrawViewpoint(colored, MAP_SIZE_FULL, visibleMap.tl());
+	Mat shown = colored;
 
 	resize(shown, resized, size);
 	//Viewpoint in the middle of the map
@@ -294,65 +394,133 @@ void PanoramaTracker::estimateOrientation(MapSize mapSize, std::vector<float> &x
 	//Get 8x8 pixel frames for each keypoint
 	int support_area_size;
 	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, support_area_size);
-	Mat map_clone = panorama_map.GetMap(mapSize);
 	//Clear the used point vectors
 	bool rotInv; tracker_settings.Get(PT_ROTATION_INVARIANT, rotInv);
 	if (rotInv){
 		matched_features_.clear();
+		matched_index_.clear();
 	}
 	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
-	//Iterate through all cells
-	debug_timer_.StartTimer("matchTemplates");
-	for (int i = 0; i < NO_OF_CELLS_X; i++)
+	bool batched; tracker_settings.Get(PT_BATCHED_MATCHING, batched);
+
+	//Collect the store slots of the keypoints of all cells that are set and visible
+	FeatureStore &store = cell_manager_.GetFeatureStore(getKeypointType(mapSize));
+	std::vector<int> &slots = scratch_.slots;
+	slots.clear();
+	for (Point cell : visible_cells_)
 	{
-		for (int j = 0; j < NO_OF_CELLS_Y; j++)
+		if (cell_manager_.Status(cell.x, cell.y))
 		{
-			//If cell is set and visible, find keypoints
-			if (cell_manager_.Status(i,j) && cell_manager_.CellVisible(i,j, viewpoint_.GetViewpoint(MAP_SIZE_FULL)))
+			int begin = store.Begin(cell.x, cell.y);
+			for (int k = 0; k < store.Count(cell.x, cell.y); k++)
 			{
-				//Get the keypoints of the current cell and iterate each keypoint
-				std::vector<PtFeature>* kps;
-				if (mapSize == MAP_SIZE_FULL || !pyr)
-					kps = cell_manager_.GetCellKeypointsPtr(i, j, PtFeature::KP_FULL_MAP);
-				else if (mapSize == MAP_SIZE_HALF)
-					kps = cell_manager_.GetCellKeypointsPtr(i, j, PtFeature::KP_HALF_MAP);
-				else
-					kps = cell_manager_.GetCellKeypointsPtr(i, j, PtFeature::KP_QUARTER_MAP);
-
-				//Iterate through each keypoint, and templatematch them
-					for (size_t k = 0; k < kps->size(); k++)
-					{
-						float movementX, movementY;
-						float quality;
-
-						//matchTemplates to calculate movement in y and x direction
-						if (matchTemplates(kps->at(k), mapSize, movementX, movementY, quality))
-						{
-							kps->at(k).movement_x = movementX;
-							kps->at(k).movement_y = movementY;
-							xMovements.push_back(movementX);
-							yMovements.push_back(movementY);
-							qualities.push_back(quality);
-						}
-						//If the tracking fails for some reason, add error values (-1000) as movements
-						else
-						{
-							kps->at(k).movement_x = -1000;
-							kps->at(k).movement_y = -1000;
-							qualities.push_back(quality);
-						}
-					}
+				slots.push_back(begin + k);
 			}
 		}
 	}
+
+	int threads; tracker_settings.Get(PT_TRACKING_THREADS, threads);
+
+	//Every feature gets its own result slot, so the results can be produced in any order
+	std::vector<FeatureMatch> &matches = scratch_.matches;
+	matches.resize(slots.size());
+	debug_timer_.StartTimer("matchTemplates");
+	//The batched matcher implements only CV_TM_SQDIFF_NORMED on grayscale images
+	if (batched && template_matching_type == CV_TM_SQDIFF_NORMED && getCurrentFrame(mapSize).type() == CV_8UC1)
+	{
+		matchTemplatesBatched(store, slots, mapSize, matches);
+	}
+	else if (threads > 1)
+	{
+		//The features are split into PT_TRACKING_THREADS stripes. The thread pool of OpenCV is shared by the whole
+		//process (the host application and the pipeline thread's warps), so its size is left alone
+		parallel_for_(Range(0, (int)slots.size()), MatchTemplatesBody(this, store, slots, mapSize, matches), threads);
+	}
+	else
+	{
+		//Templatematch each keypoint separately
+		for (size_t k = 0; k < slots.size(); k++)
+		{
+			matchTemplates(store.pt_map[slots.at(k)], mapSize, matches.at(k));
+		}
+	}
 	debug_timer_.StopTimer("matchTemplates");
+
+	//Merge the results in the feature order, so the outputs do not depend on the number of threads
+	for (size_t k = 0; k < slots.size(); k++)
+	{
+		storeFeatureMatch(store, slots.at(k), matches.at(k), xMovements, yMovements, qualities);
+	}
+	std::sort(matched_index_.begin(), matched_index_.end());
+}
+
+PtFeature::KeypointType PanoramaTracker::getKeypointType(MapSize mapSize) const
+{
+	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
+	if (mapSize == MAP_SIZE_FULL || !pyr) return PtFeature::KP_FULL_MAP;
+	if (mapSize == MAP_SIZE_HALF) return PtFeature::KP_HALF_MAP;
+	return PtFeature::KP_QUARTER_MAP;
+}
+
+void PanoramaTracker::storeFeatureMatch(FeatureStore &store, int slot, const FeatureMatch &match,
+	std::vector<float> &xMovements, std::vector<float> &yMovements, std::vector<float> &qualities)
+{
+	if (match.matched)
+	{
+		store.movement_x[slot] = match.movement_x;
+		store.movement_y[slot] = match.movement_y;
+		xMovements.push_back(match.movement_x);
+		yMovements.push_back(match.movement_y);
+		qualities.push_back(match.quality);
+	}
+	//If the tracking fails for some reason, add error values (-1000) as movements
+	else
+	{
+		store.movement_x[slot] = -1000;
+		store.movement_y[slot] = -1000;
+		qualities.push_back(match.quality);
+	}
+
+	//Add the points of the good matches, from which estimateSimilarity finds the roll and movement of the camera with the
+	//RANSAC of SimilarityEstimator: pair hypotheses solved in closed form, refined by least squares on their inliers
+	if (match.rotation_match)
+	{
+		MatchedFeature ft;
+		ft.id = store.id[slot];
+		ft.movements = Point2d(match.movement_x, match.movement_y);
+		ft.pt_map = store.pt_map[slot];
+		ft.cell = store.GetCell(slot);
+		ft.removed = false;
+		matched_index_.push_back(std::make_pair(ft.id, (int)matched_features_.size()));
+		matched_features_.push_back(ft);
+	}
+}
+
+PanoramaTracker::MatchTemplatesBody::MatchTemplatesBody(PanoramaTracker *tracker, const FeatureStore &store, const std::vector<int> &slots,
+	MapSize mapSize, std::vector<FeatureMatch> &matches) : tracker_(tracker), store_(store), slots_(slots), map_size_(mapSize), matches_(matches)
+{
+}
+
+void PanoramaTracker::MatchTemplatesBody::operator()(const Range &range) const
+{
+	//The matches are part of the frame also on the threads of the parallel loop
+	AllocationCounter::Scope allocation_scope(tracker_->frame_tally_);
+	for (int k = range.start; k < range.end; k++)
+	{
+		tracker_->matchTemplates(store_.pt_map[slots_.at(k)], map_size_, matches_.at(k));
+	}
 }
 
 float PanoramaTracker::trackAndUpdate(MapSize mapSize, std::vector<float> &allQualities)
 {
 	float filtered_xmove, filtered_ymove;
-	std::vector<float> filtered_x_vector, filtered_y_vector;
-	std::vector<float> x_move_vector, y_move_vector, quality_vector;
+	std::vector<float> &filtered_x_vector = scratch_.filtered_x, &filtered_y_vector = scratch_.filtered_y;
+	std::vector<float> &x_move_vector = scratch_.x_moves, &y_move_vector = scratch_.y_moves, &quality_vector = scratch_.map_qualities;
+	filtered_x_vector.clear();
+	filtered_y_vector.clear();
+	x_move_vector.clear();
+	y_move_vector.clear();
+	quality_vector.clear();
 	int factor, max_dev;
 
 	estimateOrientation(mapSize, x_move_vector, y_move_vector, quality_vector);
@@ -375,10 +543,10 @@ float PanoramaTracker::trackAndUpdate(MapSize mapSize, std::vector<float> &allQu
 		tracker_settings.Get(PT_MAX_DEV_FILTERING_QUARTER, max_dev);
 	}
 
-	int xmed = HelpFunctions::calculateMedian(x_move_vector);
-	int ymed = HelpFunctions::calculateMedian(y_move_vector);
-	HelpFunctions::filterMovementVectors(x_move_vector, y_move_vector, filtered_x_vector, filtered_y_vector,
-		max_dev);
+	//Medians, filtering and deviations of the movements in one call
+	OrderStatistics::MovementStatistics stats;
+	OrderStatistics::FilterMovements(x_move_vector, y_move_vector, max_dev, filtered_x_vector, filtered_y_vector,
+		scratch_.sorted, stats);
 
 	//Update values used for statistics viewing
 	if (mapSize == MAP_SIZE_FULL){
@@ -396,16 +564,94 @@ float PanoramaTracker::trackAndUpdate(MapSize mapSize, std::vector<float> &allQu
 		discarded_kp_quarter_ = x_move_vector.size() - filtered_x_vector.size();
 	}
 
-	updateFeatures(mapSize, xmed, ymed);
-	filtered_xmove = -HelpFunctions::calculateMedian(filtered_x_vector) * factor;
-	filtered_ymove = -HelpFunctions::calculateMedian(filtered_y_vector) * factor;
+	updateFeatures(mapSize, stats.median_x, stats.median_y);
+	Point2f movement(stats.filtered_median_x, stats.filtered_median_y);
+	bool measured = !filtered_x_vector.empty();
+
+	//With rotation invariance the full map movement is solved together with the roll. If that fails the
+	//median movement is used without changing the roll
+	bool rotInv; tracker_settings.Get(PT_ROTATION_INVARIANT, rotInv);
+	float roll;
+	if (mapSize == MAP_SIZE_FULL && rotInv && estimateSimilarity(mapSize, movement, roll))
+	{
+		z_rotation_ -= roll;
+		measured = true;
+	}
+	filtered_xmove = -movement.x * factor;
+	filtered_ymove = -movement.y * factor;
+	//The movement was measured from the integer viewpoint of mapSize, so it is made relative to the fractional position
+	if (measured)
+	{
+		Rect view_point = viewpoint_.GetViewpoint(mapSize);
+		filtered_xmove += view_point.x * factor - viewpoint_.precise_x;
+		filtered_ymove += view_point.y * factor - viewpoint_.precise_y;
+	}
 	updateViewpointLocation(filtered_xmove, filtered_ymove);
-	float dev_x = HelpFunctions::calculateStandardDeviation(x_move_vector);
-	float dev_y = HelpFunctions::calculateStandardDeviation(y_move_vector);
-	return (dev_x + dev_y) / 2;
+	measured_motion_ += Point2f(filtered_xmove, filtered_ymove);
+
+	//The viewpoint now contains the motion, so the following maps are searched around it
+	search_offset_ = Point2f(0, 0);
+	search_size_override_[mapSize] = 0;
+
+	//If a coarse map could not be tracked reliably, the finer maps can't rely on it and search the whole area
+	if (mapSize != MAP_SIZE_FULL && filtered_x_vector.size() < min_coarse_features_)
+	{
+		search_size_override_[MAP_SIZE_HALF] = 0;
+		search_size_override_[MAP_SIZE_FULL] = 0;
+	}
+	return (stats.deviation_x + stats.deviation_y) / 2;
 }
 
-void PanoramaTracker::updateFeatures(MapSize mapSize, int medx, int medy)
+float PanoramaTracker::trackDirect(std::vector<float> &allQualities)
+{
+	debug_timer_.StartTimer("trackDirect");
+
+	//The map region at the anchor and the pixels of it that have been mapped. They are only taken again when the
+	//viewpoint has moved away from the anchor, or the map has been written since
+	Rect view_point = viewpoint_.GetViewpoint(MAP_SIZE_FULL);
+	if (direct_anchor_.size() != view_point.size() || direct_anchor_version_ != panorama_map.GetVersion()
+		|| std::abs(view_point.x - direct_anchor_.x) > view_point.width / 8 || std::abs(view_point.y - direct_anchor_.y) > view_point.height / 8)
+	{
+		Mat templ = panorama_map.GetRegion(view_point, MAP_SIZE_FULL);
+		if (templ.type() != CV_8UC1)
+		{
+			cvtColor(templ, direct_template_, CV_BGR2GRAY);
+			templ = direct_template_;
+		}
+		direct_aligner_.SetTemplate(templ, panorama_map.GetCoverage().ToMat(view_point, 255));
+		direct_anchor_ = view_point;
+		direct_anchor_version_ = panorama_map.GetVersion();
+	}
+
+	//Start from the predicted movement of the features, seen from the anchor
+	DirectAligner::Motion motion;
+	motion.translation = search_offset_ + Point2f((float)(direct_anchor_.x - view_point.x), (float)(direct_anchor_.y - view_point.y));
+	motion.angle = 0;
+	motion.error = 1;
+	motion.deviation = 0;
+	bool aligned = direct_aligner_.Align(current_frame_, panorama_map.GetMask(PanoramaMap::MASK_CURRENT), motion);
+	direct_iterations_ = motion.iterations;
+
+	//A failed alignment is reported with the worst quality, which starts the relocalization
+	allQualities.push_back(aligned ? motion.error : 1);
+	if (aligned)
+	{
+		//The translation is the movement of the features, measured from the anchor
+		float x_move = -motion.translation.x + direct_anchor_.x - viewpoint_.precise_x;
+		float y_move = -motion.translation.y + direct_anchor_.y - viewpoint_.precise_y;
+		bool rotInv; tracker_settings.Get(PT_ROTATION_INVARIANT, rotInv);
+		if (rotInv) z_rotation_ -= motion.angle * 180 / M_PI;
+		updateViewpointLocation(x_move, y_move);
+		measured_motion_ += Point2f(x_move, y_move);
+	}
+	search_offset_ = Point2f(0, 0);
+	debug_timer_.StopTimer("trackDirect");
+	//There are no separate feature movements. The deviation is the displacement the remaining photometric error implies,
+	//so that PT_MAX_DEVIATION rejects a diverged alignment like it rejects scattered feature movements
+	return aligned ? motion.deviation : 0;
+}
+
+void PanoramaTracker::updateFeatures(MapSize mapSize, float medx, float medy)
 {
 	debug_timer_.StartTimer("updateFeatures");
 	int max_diff;
@@ -413,56 +659,54 @@ void PanoramaTracker::updateFeatures(MapSize mapSize, int medx, int medy)
 	else if (mapSize == MAP_SIZE_HALF) tracker_settings.Get(PT_MAX_DEV_FILTERING_HALF, max_diff);
 	else tracker_settings.Get(PT_MAX_DEV_FILTERING_QUARTER, max_diff);
 
-	std::vector<float> x_move_vector, y_move_vector;
-	for (int i = 0; i < NO_OF_CELLS_X; i++)
+	FeatureStore &store = cell_manager_.GetFeatureStore(getKeypointType(mapSize));
+	for (Point cell : visible_cells_)
 	{
-		for (int j = 0; j < NO_OF_CELLS_Y; j++)
+		bool features_erased = false;
+		int begin = store.Begin(cell.x, cell.y);
+		
+		//If the features movement is too far from the median movement, lower its quality
+		for (int k = 0; k < store.Count(cell.x, cell.y);)
 		{
-			bool features_erased = false;
-			if (cell_manager_.CellVisible(i, j, viewpoint_.GetViewpoint(MAP_SIZE_FULL))){
-				std::vector<PtFeature>* features;
-				if (mapSize == MAP_SIZE_FULL) features = cell_manager_.GetCellKeypointsPtr(i,j, PtFeature::KP_FULL_MAP);
-				else if (mapSize == MAP_SIZE_HALF) features = cell_manager_.GetCellKeypointsPtr(i,j, PtFeature::KP_HALF_MAP);
-				else features = cell_manager_.GetCellKeypointsPtr(i, j, PtFeature::KP_QUARTER_MAP);
-				
-				//If the features movement is too far from the median movement, lower its quality
-				for (std::vector<PtFeature>::iterator it = features->begin(); it != features->end();)
+			int slot = begin + k;
+			float x_mov = store.movement_x[slot];
+			float y_mov = store.movement_y[slot];
+			//Lower the quality if the feature has been updated last frame(!=-1000) and deviation from median is larger than max_diff
+			if ((std::abs(x_mov - medx) > max_diff || std::abs(y_mov - medy) > max_diff) && x_mov != -1000)
+			{
+				store.quality[slot] -= .05;
+			}
+			//Else raise the quality higher, but not past 1
+			else
+			{
+				if (store.quality[slot] < 1){
+					store.quality[slot] += .25;
+				}
+			}
+			//Check feature quality. Removing moves the last feature of the cell to this slot, so it is checked next
+			if (store.quality[slot] <= 0)
+			{
+				if (mapSize == MAP_SIZE_FULL) removed_points_full_++;
+				else if (mapSize == MAP_SIZE_HALF) removed_points_half_++;
+				else removed_points_quarter_++;
+				features_erased = true;
+				//Removed features can't be used in rotation estimation anymore
+				std::vector<std::pair<int, int>>::iterator matched = std::lower_bound(matched_index_.begin(), matched_index_.end(),
+					std::make_pair(store.id[slot], -1));
+				if (matched != matched_index_.end() && matched->first == store.id[slot])
 				{
-					int x_mov = it->movement_x;
-					int y_mov = it->movement_y;
-					//Lower the quality if the feature has been updated last frame(!=-1000) and deviation from median is larger than max_diff
-					if ((abs(x_mov - medx) > max_diff || abs(y_mov - medy) > max_diff) && x_mov != -1000)
-					{
-						it->quality -= .05;
-					}
-					//Else raise the quality higher, but not past 1
-					else
-					{
-						if (it->quality < 1){
-							it->quality += .25;
-						}
-						x_move_vector.push_back(it->movement_x);
-						y_move_vector.push_back(it->movement_y);
-					}
-					//Check feature quality
-					if (it->quality <= 0)
-					{
-						if (mapSize == MAP_SIZE_FULL) removed_points_full_++;
-						else if (mapSize == MAP_SIZE_HALF) removed_points_half_++;
-						else removed_points_quarter_++;
-						features_erased = true;
-						it = features->erase(it);
-					}
-					else
-					{
-						++it;
-					}
+					matched_features_.at(matched->second).removed = true;
 				}
-				//Here update cell, for now during largest map check only
-				//using features_erased ensures that we don't do the check for cells that were already empty, i.e. in a position where no good features are available
-				if (features_erased && mapSize == MAP_SIZE_FULL) updateCell(i, j);
+				store.Remove(cell.x, cell.y, k);
+			}
+			else
+			{
+				++k;
 			}
 		}
+		//Here update cell, for now during largest map check only
+		//using features_erased ensures that we don't do the check for cells that were already empty, i.e. in a position where no good features are available
+		if (features_erased && mapSize == MAP_SIZE_FULL) updateCell(cell.x, cell.y);
 	}
 	debug_timer_.StopTimer("updateFeatures");
 
@@ -470,11 +714,20 @@ void PanoramaTracker::updateFeatures(MapSize mapSize, int medx, int medy)
 
 void PanoramaTracker::updateCell(int x, int y)
 {
-	//Find new features, if the cell becomes empty 
-	if (cell_manager_.GetCellKeypoints(x,y, PtFeature::KP_FULL_MAP).size() < 1)
+	//Find new features, if the cell becomes empty. The cached candidates are used first, and the pixels
+	//are searched again only when they have run out
+	if (cell_manager_.GetCellKeypointCount(x, y, PtFeature::KP_FULL_MAP) < 1)
 	{
-		getKeypoints(x, y, MAP_SIZE_FULL);
-		std::cout << "keypointsearch" << std::endl;
+		int max_kp; tracker_settings.Get(PT_MAX_KEYPOINTS_PER_CELL, max_kp);
+		std::vector<PtFeature> features;
+		if (cell_manager_.TakeCellCandidates(x, y, max_kp, features) > 0)
+		{
+			cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_FULL_MAP, features);
+		}
+		else
+		{
+			getKeypoints(x, y, MAP_SIZE_FULL);
+		}
 	}
 }
 
@@ -483,16 +736,103 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 	//this is the main tracking function!
 
 	debug_timer_.StartTimer("CalculateOrientation");
+	frame_tally_.Reset();
+	AllocationCounter::Scope allocation_scope(frame_tally_);
 
 	//Update current frame data
 	debug_timer_.StartTimer("update current frame call");
 	updateCurrentFrame(currentFrame);
 	debug_timer_.StopTimer("update current frame call");
 
+	trackCurrentFrame();
+	frame_allocations_ = frame_tally_.Count();
+	debug_timer_.StopTimer("CalculateOrientation");
+}
+
+bool PanoramaTracker::CalculateOrientationPipelined(Mat currentFrame)
+{
+	if (!frame_pipeline_)
+	{
+		int capacity; tracker_settings.Get(PT_PIPELINE_QUEUE_SIZE, capacity);
+		int policy; tracker_settings.Get(PT_PIPELINE_DROP_POLICY, policy);
+		frame_pipeline_.reset(new FramePipeline([this](FramePipeline::Frame &frame)
+		{
+			//Counted separately, since the frame may be dropped or tracked after a later one has been prepared
+			AllocationCounter::Tally tally;
+			{
+				AllocationCounter::Scope allocation_scope(tally);
+				prepareFrame(frame, pipeline_warper_, nullptr);
+			}
+			frame.allocations = tally.Count();
+		}, capacity, (FramePipeline::DropPolicy)policy));
+		frame_pipeline_->ReportOrientation(-1, x_rotation_, y_rotation_, z_rotation_);
+	}
+
+	/*
+	The frames are tracked as they come out of the pipeline, without waiting for them to be prepared, so the caller
+	is not held up by the warping. When the preparation falls behind the frames pile up to the queue size, and the
+	drop policy decides which of them are tracked. The caller is the only one taking frames out of the pipeline,
+	so with BLOCK a full pipeline is made room for by tracking its oldest frame before pushing the new one
+	*/
+	frame_tally_.Reset();
+	AllocationCounter::Scope allocation_scope(frame_tally_);
+	FramePipeline::Frame frame;
+	bool have_frame = false;
+	if (frame_pipeline_->GetPolicy() == FramePipeline::BLOCK && frame_pipeline_->InFlight() >= frame_pipeline_->GetCapacity())
+	{
+		have_frame = frame_pipeline_->Pop(frame);
+	}
+	bool queued = frame_pipeline_->Push(currentFrame, debug_warp_check);
+	if (!have_frame)
+	{
+		have_frame = frame_pipeline_->TryPop(frame);
+	}
+	//A full pipeline rejected the new frame. Wait for the oldest one instead, which also makes room for the next frame
+	if (!have_frame && !queued)
+	{
+		have_frame = frame_pipeline_->Pop(frame);
+	}
+	if (!have_frame)
+	{
+		return false;
+	}
+
+	debug_timer_.StartTimer("CalculateOrientation");
+	installFrame(frame);
+	trackCurrentFrame();
+	frame_tally_.Add(frame.allocations);
+	frame_allocations_ = frame_tally_.Count();
+
+	//The next frames are warped with the orientation extrapolated with the motion model of the tracking
+	Point2f motion = motion_model_.Predict();
+	float x_velocity = pixelsToDegreesX(motion.x) - pixelsToDegreesX(0);
+	float y_velocity = motion.y * map_vertical_degrees_ / panorama_map.GetHeight();
+	frame_pipeline_->ReportOrientation(frame.sequence, x_rotation_, y_rotation_, z_rotation_, x_velocity, y_velocity);
+	debug_timer_.StopTimer("CalculateOrientation");
+	return true;
+}
+
+int PanoramaTracker::GetDroppedFrames() const
+{
+	return frame_pipeline_ ? frame_pipeline_->DroppedFrames() : 0;
+}
+
+long long PanoramaTracker::GetFrameAllocations() const
+{
+	return frame_allocations_;
+}
+
+void PanoramaTracker::trackCurrentFrame()
+{
+	//Take the map and the cells published by the mapping thread into use. The mapping thread writes its own copy
+	//of the map, so the map stays the same for the rest of the frame without locking
+	installMappedCells();
+
 	float min_tracking_quality;
 	tracker_settings.Get(PT_MIN_TRACKING_QUALITY, min_tracking_quality);
 	static float degrees_moved_x, degrees_moved_y;
-	std::vector<float> all_qualities;
+	std::vector<float> &all_qualities = scratch_.qualities;
+	all_qualities.clear();
 	float previous_x_orientation = x_rotation_;
 	float previous_y_orientation = y_rotation_;
 	bool sufficient_quality = false;
@@ -502,17 +842,24 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 	float dev1 = 0, dev2 = 0, dev3 = 0;
 	if (tracking_status == TRACKING_KEYPOINTS){
 		bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
-		bool rot_invariant; tracker_settings.Get(PT_ROTATION_INVARIANT, rot_invariant);
-		//If using pyramidical approach, estimate orientation first for smaller versions of the map
-		if (pyr){
-			dev1 = trackAndUpdate(MAP_SIZE_QUARTER, all_qualities);
-			dev2 = trackAndUpdate(MAP_SIZE_HALF, all_qualities);
+		//Offset the search windows of the first tracked map by the predicted motion, and
+		//narrow the searches of the finer maps in coarse to fine mode
+		bool direct; tracker_settings.Get(PT_DIRECT_ALIGNMENT, direct);
+		setupSearchAreas(pyr && !direct ? MAP_SIZE_QUARTER : MAP_SIZE_FULL);
+
+		//The direct alignment builds its own pyramid, and replaces the feature tracking on all maps
+		if (direct){
+			dev3 = trackDirect(all_qualities);
+		}
+		else{
+			//If using pyramidical approach, estimate orientation first for smaller versions of the map
+			if (pyr){
+				dev1 = trackAndUpdate(MAP_SIZE_QUARTER, all_qualities);
+				dev2 = trackAndUpdate(MAP_SIZE_HALF, all_qualities);
+			}
+			//finally track on the whole map
+			dev3 = trackAndUpdate(MAP_SIZE_FULL, all_qualities);
 		}
-		//finally track on the whole map
-		dev3 = trackAndUpdate(MAP_SIZE_FULL, all_qualities);
-
-		//If rotation estimation is toggled on
-		if (rot_invariant) estimateRotation();
 
 		//Get the average quality and standard deviation of the tracking during the frame
 		average_quality_ = HelpFunctions::calculateAverage(all_qualities);
@@ -540,6 +887,7 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 		if (!sufficient_quality){
 			tracking_status = RELOCALIZING;
 		}
+		endMotionPrediction(sufficient_quality);
 	}	//END IF tracking_status == TRACKING_KEYPOINTS
 
 	if (tracking_status == RELOCALIZING)
@@ -550,6 +898,9 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 	//Don't add new relocalization points if tracking quality is bad, since
 	//that will result in relocalizationPoints that have incorrect rotation values
 	if (sufficient_quality){
+		last_good_x_rotation_ = x_rotation_;
+		last_good_y_rotation_ = y_rotation_;
+		failed_relocalizations_ = 0;
 		float diff_x = previous_x_orientation - x_rotation_;
 		float diff_y = previous_y_orientation - y_rotation_;
 		//Add new relocalization points every x or y degrees
@@ -558,7 +909,7 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 		if (degrees_moved_x > 10 || degrees_moved_x < -10 || degrees_moved_y > 10 || degrees_moved_y < -10)
 		{
 			//Use the non-warped frames with relocalizer <--why?
-			relocalizer.AddRelocImage(current_frame_non_warped_, x_rotation_, y_rotation_, z_rotation_);
+			relocalizer.AddRelocImage(getNonWarpedFrame(), x_rotation_, y_rotation_, z_rotation_);
 			degrees_moved_x = 0;
 			degrees_moved_y = 0;
 		}
@@ -583,12 +934,12 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 	if (x_rotation_ < min_rotation_){
 		min_rotation_ = x_rotation_;
 		min_rot_px_ = viewpoint_.x;
-		min_rot_img_ = current_frame_.clone();
+		current_frame_.copyTo(min_rot_img_);
 	}
 	if (x_rotation_ > max_rotation_){
 		max_rotation_ = x_rotation_;
 		max_rot_px_ = viewpoint_.x;
-		max_rot_img_ = current_frame_.clone();
+		current_frame_.copyTo(max_rot_img_);
 	}
 
 	//If 370 degrees are reached and loop closing is not yet done, call the loop closing function
@@ -596,20 +947,69 @@ void PanoramaTracker::CalculateOrientation(Mat currentFrame)
 	{
 		panorama_map.LoopClose(min_rot_px_, max_rot_px_, current_frame_.size(), min_rot_img_, max_rot_img_);
 	}
-
-	debug_timer_.StopTimer("CalculateOrientation");
 }
 
 void PanoramaTracker::Relocalize()
 {
-	float x, y, z, quality, min_quality;
-	tracker_settings.Get(PT_MIN_RELOC_QUALITY, min_quality);
-	relocalizer.Relocalize(current_frame_non_warped_, x, y, z, quality);
+	bool async; tracker_settings.Get(PT_ASYNC_RELOCALIZATION, async);
+	if (async)
+	{
+		relocalizeAsync();
+		return;
+	}
+
+	float x, y, z, quality;
+	relocalizer.Relocalize(getNonWarpedFrame(), last_good_x_rotation_, last_good_y_rotation_, getRelocSearchWindow(), x, y, z, quality);
+	applyRelocalization(x, y, z, quality);
+}
+
+void PanoramaTracker::relocalizeAsync()
+{
+	if (!reloc_worker_)
+	{
+		reloc_worker_ = std::make_shared<RelocalizationWorker>();
+	}
+
+	//Adopt a finished result first. It was computed from one of the previous frames,
+	//which is close enough for the keypoint tracking to continue from
+	RelocalizationWorker::Result result;
+	if (reloc_worker_->PollResult(result) && applyRelocalization(result.x_rot, result.y_rot, result.z_rot, result.quality))
+	{
+		reloc_worker_->Cancel();
+		return;
+	}
+
+	//The worker gets its own copy of the relocalizer. No points are added while relocalizing,
+	//so the copy is only refreshed after tracking has added new points
+	if (!reloc_snapshot_ || reloc_snapshot_->GetSize() != relocalizer.GetSize())
+	{
+		reloc_snapshot_ = std::make_shared<const Relocalizer>(relocalizer.Clone());
+	}
+	//Replaces the request of the previous frame if the worker has not started it yet
+	reloc_worker_->Submit(reloc_snapshot_, getNonWarpedFrame(), last_good_x_rotation_, last_good_y_rotation_, getRelocSearchWindow());
+}
+
+float PanoramaTracker::getRelocSearchWindow() const
+{
+	//Search near the last good orientation first, doubling the window after every failed attempt
+	//until it covers the whole map
+	float window; tracker_settings.Get(PT_RELOC_SEARCH_WINDOW, window);
+	if (window > 0)
+	{
+		window *= (float)(1 << std::min(failed_relocalizations_, 8));
+		if (window >= 180) window = 0;
+	}
+	return window;
+}
+
+bool PanoramaTracker::applyRelocalization(float x, float y, float z, float quality)
+{
+	float min_quality; tracker_settings.Get(PT_MIN_RELOC_QUALITY, min_quality);
 
 	//If the relocalization quality is bad, don't move the viewpoint
 	if (quality < min_quality){
 		//Calculate the movement amounts in x and y directions and move viewpoint to the new pos accordingly
-		float old_x = viewpoint_.x, old_y = viewpoint_.y;
+		float old_x = viewpoint_.precise_x, old_y = viewpoint_.precise_y;
 		float new_x = degreesToPixelsX(x) - viewpoint_.width / 2;
 		float y_corr = y + map_vertical_degrees_ / 2;
 		float perc_of_vertical = y_corr / map_vertical_degrees_;
@@ -619,18 +1019,36 @@ void PanoramaTracker::Relocalize()
 		z_rotation_ = z;
 		updateViewpointLocation(-diff_x, -diff_y);
 		tracking_status = TRACKING_KEYPOINTS;
+		failed_relocalizations_ = 0;
+		return true;
 	}
+	failed_relocalizations_++;
+	return false;
 }
 
 
 void PanoramaTracker::SetRelocalizer(const Relocalizer& rl)
 {
 	relocalizer = rl;
+	reloc_snapshot_.reset();
 }
 
 void PanoramaTracker::SetPanoramaMap(const PanoramaMap& map)
 {
+	if (mapping_worker_)
+	{
+		mapping_worker_->WaitIdle();
+		installMappedCells();
+	}
 	panorama_map = map;
+	//The versions of different maps can not be compared, so the direct alignment takes its template again
+	direct_anchor_ = Rect();
+	if (mapping_worker_)
+	{
+		//The mapping thread continues from the new map and the cells complete in it
+		mapping_map_ = map;
+		syncMappedCells();
+	}
 }
 
 float PanoramaTracker::GetOrientationX() const
@@ -655,12 +1073,12 @@ float PanoramaTracker::GetQuality() const
 
 int PanoramaTracker::GetOrientationXPixels() const{
 	//Return the pixel coordinate of viewpoint center
-	return ((viewpoint_.x + viewpoint_.width / 2) * x_res_scaling_)-(panorama_map.GetWidth() / 2);
+	return ((viewpoint_.precise_x + viewpoint_.width / 2) * x_res_scaling_)-(panorama_map.GetWidth() / 2);
 }
 
 int PanoramaTracker::GetOrientationYPixels() const{
 	//Return the pixel coordinate of viewpoint center
-	return (viewpoint_.y + viewpoint_.height / 2) * x_res_scaling_ - (panorama_map.GetHeight() / 2);
+	return (viewpoint_.precise_y + viewpoint_.height / 2) * x_res_scaling_ - (panorama_map.GetHeight() / 2);
 }
 
 void PanoramaTracker::SetOrientation(float x, float y, float z)
@@ -696,7 +1114,32 @@ std::string PanoramaTracker::GetDebugData()
 	<< "discarded kps/map: " << discarded_kp_full_ << "," << discarded_kp_half_ << "," << discarded_kp_quarter_ << ";"
 	<< "removed kps/map: " << removed_points_full_ << "," << removed_points_half_ << "," << removed_points_quarter_ << ";"
 	<< "average quality: " << average_quality_ << ";"
-	<< "tracking deviation: " << deviation_ << ";\n";
+	<< "tracking deviation: " << deviation_ << ";";
+
+	ss << "warp cache hits/misses: " << warp_cache_hits_ << "," << warp_cache_misses_ << ";";
+	ss << "feature store bytes: " << cell_manager_.GetFeatureMemoryFootprint() << ";";
+	ss << "map tile bytes: " << panorama_map.GetMemoryFootprint() << ";";
+	if (mapping_worker_)
+	{
+		ss << "mapping jobs dropped: " << mapping_worker_->GetDroppedJobs() << ";";
+	}
+	ss << "predicted motion: " << predicted_motion_.x << "," << predicted_motion_.y << ";"
+	<< "measured motion: " << measured_motion_.x << "," << measured_motion_.y << ";"
+	<< "prediction uncertainty: " << motion_model_.GetUncertainty() << ";"
+	<< "search size: " << used_search_size_ << ";";
+	if (debug_warp_check)
+	{
+		ss << "separable warp error: " << warp_check_error_ << ";";
+	}
+	bool direct; tracker_settings.Get(PT_DIRECT_ALIGNMENT, direct);
+	if (direct)
+	{
+		ss << "direct alignment iterations: " << direct_iterations_ << ";";
+	}
+#ifdef PT_COUNT_ALLOCATIONS
+	ss << "frame allocations" << (AllocationCounter::SeesMatAllocations() ? "" : " without Mat data") << ": " << frame_allocations_ << ";";
+#endif
+	ss << "\n";
 
 	debug_timer_.ClearAll();
 	
@@ -707,133 +1150,335 @@ std::string PanoramaTracker::GetDebugData()
 void PanoramaTracker::UpdateColumn(Point clickedPoint)
 {
 	int column = clickedPoint.x / cell_manager_.GetCellHeight(MAP_SIZE_FULL);
+
+	//Let the mapping thread finish, so the column is not completed again by an older frame
+	if (mapping_worker_)
+	{
+		mapping_worker_->WaitIdle();
+		installMappedCells();
+	}
 	
 	//Set the cell statuses of changed cells to false
 	for (int i = 0; i < NO_OF_CELLS_Y; i++)
 	{
 		cell_manager_.Status(column, i, false);
+		mapped_cells_[column][i] = false;
+	}
+	Rect column_area(column * cell_manager_.GetCellHeight(MAP_SIZE_FULL), 0, cell_manager_.GetCellWidth(MAP_SIZE_FULL), panorama_map.GetHeight());
+	panorama_map.UpdateColumn(column_area);
+	if (mapping_worker_)
+	{
+		mapping_map_.UpdateColumn(column_area);
 	}
-	panorama_map.UpdateColumn(Rect(column * cell_manager_.GetCellHeight(MAP_SIZE_FULL), 0, cell_manager_.GetCellWidth(MAP_SIZE_FULL), panorama_map.GetHeight()));
 }
 
 
 std::vector<PtFeature> PanoramaTracker::getKeypoints(int x, int y, MapSize mapSize)
+{
+	//The full map cells keep candidates for re-seeding
+	std::vector<PtFeature> candidates;
+	std::vector<PtFeature> pt_features = findKeypoints(cell_manager_.GetCellContents(x, y, mapSize, panorama_map), x, y, mapSize,
+		mapSize == MAP_SIZE_FULL ? &candidates : nullptr);
+
+	//Put keypoints in appropriate arrays according to the map size being handled
+	if (mapSize == MAP_SIZE_FULL)
+	{
+		cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_FULL_MAP, pt_features);
+		cell_manager_.SetCellCandidates(x, y, candidates);
+	}
+	if (mapSize == MAP_SIZE_HALF)
+	{
+		cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_HALF_MAP, pt_features);
+	}
+	if (mapSize == MAP_SIZE_QUARTER)
+	{
+		cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_QUARTER_MAP, pt_features);
+	}
+	
+	return pt_features;
+}
+
+std::vector<PtFeature> PanoramaTracker::findKeypoints(const Mat &cellContents, int x, int y, MapSize mapSize, std::vector<PtFeature> *candidates) const
 {
 	int cell_width = cell_manager_.GetCellWidth(mapSize);
 	int cell_height = cell_manager_.GetCellHeight(mapSize);
-	std::vector<KeyPoint> key_points;
-	int kp_thresh, max_kp;
-	tracker_settings.Get(PT_FAST_KEYPOINT_THRESHOLD, kp_thresh);
+	std::vector<KeyPoint> accepted_points;
+	int max_kp, support_area_size;
 	tracker_settings.Get(PT_MAX_KEYPOINTS_PER_CELL, max_kp);
-	FAST(cell_manager_.GetCellContents(x, y, mapSize, panorama_map.GetMap(mapSize)), key_points, kp_thresh);
+	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, support_area_size);
+	int sh = support_area_size / 2;
+	//The candidates are the next best keypoints after the max_kp that are used
+	size_t ranked = max_kp;
+	if (candidates) ranked += max_kp * reseed_rounds_;
 
-	//Dont accept keypoints that are on the edge of the cell (conflicting support areas, i.e. the support area would
-	//extend to the adjacent cell)
-	std::vector<KeyPoint> accepted_points;
-	int sh;
-	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, sh);
-	sh = sh / 2;
-	for (int i = 0; i < key_points.size(); i++)
-	{
-		if (key_points.at(i).pt.x - sh >= 0 && key_points.at(i).pt.y - sh >= 0
-			&& key_points.at(i).pt.x + sh <= cell_width && key_points.at(i).pt.y + sh <= cell_height){
-			accepted_points.push_back(key_points.at(i));
-		}
+	bool grid_fast; tracker_settings.Get(PT_GRID_FAST, grid_fast);
+	if (grid_fast)
+	{
+		//Already ranked, off the edges and separated so that the support areas do not overlap
+		grid_fast_detector_.Detect(cellContents, sh, support_area_size, (int)ranked, accepted_points);
 	}
-	//Sort the keypoints according to their quality (i.e. the response given by FAST)
-	std::sort(accepted_points.begin(), accepted_points.end(), HelpFunctions::compareKeypoints);
-
-	//if there are too many keypoints, only select the first max_kp from the sorted vector
-	if (accepted_points.size() > max_kp)
+	else
 	{
-		accepted_points.resize(max_kp);
+		std::vector<KeyPoint> key_points;
+		int kp_thresh;
+		tracker_settings.Get(PT_FAST_KEYPOINT_THRESHOLD, kp_thresh);
+		FAST(cellContents, key_points, kp_thresh);
+
+		//Dont accept keypoints that are on the edge of the cell (conflicting support areas, i.e. the support area would
+		//extend to the adjacent cell)
+		for (int i = 0; i < key_points.size(); i++)
+		{
+			if (key_points.at(i).pt.x - sh >= 0 && key_points.at(i).pt.y - sh >= 0
+				&& key_points.at(i).pt.x + sh <= cell_width && key_points.at(i).pt.y + sh <= cell_height){
+				accepted_points.push_back(key_points.at(i));
+			}
+		}
+		//Only the best keypoints are used, so only they are sorted according to their quality (i.e. the response given by FAST)
+		ranked = std::min(ranked, accepted_points.size());
+		std::partial_sort(accepted_points.begin(), accepted_points.begin() + ranked, accepted_points.end(), HelpFunctions::compareKeypoints);
+		accepted_points.resize(ranked);
 	}
 
-	//Transform the KeyPoint objects to PtFeature objects
+	//Transform the KeyPoint objects to PtFeature objects, the first max_kp are the keypoints of the cell
 	std::vector<PtFeature> pt_features;
 	for (size_t i = 0; i < accepted_points.size(); i++)
 	{
 		Point map_point(accepted_points.at(i).pt.x + x*cell_width, accepted_points.at(i).pt.y + y*cell_height);
 		PtFeature feature(accepted_points.at(i).pt, map_point);
-		pt_features.push_back(feature);
+		if (i < (size_t)max_kp) pt_features.push_back(feature);
+		else candidates->push_back(feature);
 	}
+	return pt_features;
+}
 
-	//Put keypoints in appropriate arrays according to the map size being handled
-	if (mapSize == MAP_SIZE_FULL)
+void PanoramaTracker::syncMappedCells()
+{
+	for (int i = 0; i < NO_OF_CELLS_X; i++)
 	{
-		cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_FULL_MAP, pt_features);
+		for (int j = 0; j < NO_OF_CELLS_Y; j++)
+		{
+			mapped_cells_[i][j] = cell_manager_.Status(i, j);
+		}
 	}
-	if (mapSize == MAP_SIZE_HALF)
+}
+
+void PanoramaTracker::startMapping()
+{
+	//The mapping thread continues from the current map and the cells that are already complete.
+	//The copy shares the tiles with the map of the tracking until the mapping thread writes them
+	mapping_map_ = panorama_map;
+	syncMappedCells();
+	mapping_worker_.reset(new MappingWorker([this](const MappingWorker::Job &job, MappingWorker::Result &result)
 	{
-		cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_HALF_MAP, pt_features);
+		mapFrame(job, result);
+	}, max_mapping_jobs_));
+}
+
+void PanoramaTracker::mapFrame(const MappingWorker::Job &job, MappingWorker::Result &result)
+{
+	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
+	Viewpoint viewpoint = job.viewpoint;
+	std::vector<Point> changed_cells;
+
+	//Same as updateMap: cells completed by the earlier updates are marked before this update,
+	//so that the smaller maps are updated for them
+	for (Point cell : cell_manager_.GetVisibleCells(viewpoint.GetViewpoint(MAP_SIZE_FULL)))
+	{
+		if (!mapped_cells_[cell.x][cell.y] && mapping_map_.GetCoverage().IsCellComplete(cell.x, cell.y))
+		{
+			mapped_cells_[cell.x][cell.y] = true;
+			changed_cells.push_back(cell);
+		}
 	}
-	if (mapSize == MAP_SIZE_QUARTER)
+	int version = mapping_map_.GetVersion();
+	mapping_map_.UpdateMap(viewpoint, job.frame, job.view_mask, changed_cells);
+
+	//The tracking does not read the map of the mapping thread, so the keypoints are searched from it directly
+	for (size_t i = 0; i < changed_cells.size(); i++)
 	{
-		cell_manager_.SetCellKeypoints(x, y, PtFeature::KP_QUARTER_MAP, pt_features);
+		MappingWorker::CellFeatures cell;
+		cell.cell = changed_cells[i];
+		cell.features[PtFeature::KP_FULL_MAP] = findKeypoints(cell_manager_.GetCellContents(cell.cell.x, cell.cell.y, MAP_SIZE_FULL, mapping_map_),
+			cell.cell.x, cell.cell.y, MAP_SIZE_FULL, &cell.candidates);
+		if (pyr){
+			cell.features[PtFeature::KP_HALF_MAP] = findKeypoints(cell_manager_.GetCellContents(cell.cell.x, cell.cell.y, MAP_SIZE_HALF, mapping_map_),
+				cell.cell.x, cell.cell.y, MAP_SIZE_HALF);
+			cell.features[PtFeature::KP_QUARTER_MAP] = findKeypoints(cell_manager_.GetCellContents(cell.cell.x, cell.cell.y, MAP_SIZE_QUARTER, mapping_map_),
+				cell.cell.x, cell.cell.y, MAP_SIZE_QUARTER);
+		}
+		result.completed_cells.push_back(cell);
+	}
+
+	//Publish a snapshot of the changed map. It shares the tiles, which are copied when the mapping thread writes them again
+	if (mapping_map_.GetVersion() != version)
+	{
+		result.map = mapping_map_;
+		result.map_changed = true;
 	}
-	
-	return pt_features;
 }
 
-bool PanoramaTracker::matchTemplates(PtFeature &feature, MapSize mapSize, float &movementX, float &movementY, float &qualityVal)
+void PanoramaTracker::installMappedCells()
 {
-	//Try to find the feature around the area where it was during the previous frame
-	Mat current_frame;
-	Rect view_point;
+	if (!mapping_worker_) return;
+	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
+	std::vector<MappingWorker::CellFeatures> completed_cells;
+	PanoramaMap published;
+	if (mapping_worker_->TakePublished(completed_cells, published))
+	{
+		//The previous map is released with published, so the mapping thread does not need to copy its tiles anymore
+		panorama_map.SwapContent(published);
+	}
+	for (size_t i = 0; i < completed_cells.size(); i++)
+	{
+		const MappingWorker::CellFeatures &cell = completed_cells[i];
+		cell_manager_.Status(cell.cell.x, cell.cell.y, true);
+		cell_manager_.SetCellKeypoints(cell.cell.x, cell.cell.y, PtFeature::KP_FULL_MAP, cell.features[PtFeature::KP_FULL_MAP]);
+		cell_manager_.SetCellCandidates(cell.cell.x, cell.cell.y, cell.candidates);
+		if (pyr){
+			cell_manager_.SetCellKeypoints(cell.cell.x, cell.cell.y, PtFeature::KP_HALF_MAP, cell.features[PtFeature::KP_HALF_MAP]);
+			cell_manager_.SetCellKeypoints(cell.cell.x, cell.cell.y, PtFeature::KP_QUARTER_MAP, cell.features[PtFeature::KP_QUARTER_MAP]);
+		}
+	}
+}
+
+Mat PanoramaTracker::getCurrentFrame(MapSize mapSize) const
+{
+	if (mapSize == MAP_SIZE_FULL) return current_frame_;
+	if (mapSize == MAP_SIZE_HALF) return current_frame_half_;
+	return current_frame_quarter_;
+}
+
+int PanoramaTracker::getSearchSize(MapSize mapSize) const
+{
+	if (search_size_override_[mapSize] > 0) return search_size_override_[mapSize];
 	int support_area_search_size;
-	int template_size;
-	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, template_size);
+	if (mapSize == MAP_SIZE_FULL) tracker_settings.Get(PT_SUPPORT_AREA_SEARCH_SIZE_FULL, support_area_search_size);
+	else if (mapSize == MAP_SIZE_HALF) tracker_settings.Get(PT_SUPPORT_AREA_SEARCH_SIZE_HALF, support_area_search_size);
+	else tracker_settings.Get(PT_SUPPORT_AREA_SEARCH_SIZE_QUARTER, support_area_search_size);
+	return support_area_search_size;
+}
 
-	//Get the frame used in the tracking according to the map size
-	if (mapSize == MAP_SIZE_FULL){
-		current_frame = current_frame_;
-		tracker_settings.Get(PT_SUPPORT_AREA_SEARCH_SIZE_FULL, support_area_search_size);
-	}
-	else if (mapSize == MAP_SIZE_HALF){
-		current_frame = current_frame_half_;
-		tracker_settings.Get(PT_SUPPORT_AREA_SEARCH_SIZE_HALF, support_area_search_size);
+Point PanoramaTracker::getSearchOffset(MapSize mapSize) const
+{
+	float factor = mapSize == MAP_SIZE_FULL ? 1.f : (mapSize == MAP_SIZE_HALF ? 2.f : 4.f);
+	return Point(cvRound(search_offset_.x / factor), cvRound(search_offset_.y / factor));
+}
+
+void PanoramaTracker::setupSearchAreas(MapSize firstMapSize)
+{
+	predicted_motion_ = Point2f(0, 0);
+	measured_motion_ = Point2f(0, 0);
+	search_offset_ = Point2f(0, 0);
+	for (int i = 0; i < 3; i++) search_size_override_[i] = 0;
+	int template_size; tracker_settings.Get(PT_SUPPORT_AREA_SIZE, template_size);
+
+	//In coarse to fine mode the quarter map finds the motion, and the finer maps only refine it
+	//within a few pixels of where the coarser maps moved the viewpoint
+	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
+	bool coarse_to_fine; tracker_settings.Get(PT_COARSE_TO_FINE, coarse_to_fine);
+	if (pyr && coarse_to_fine)
+	{
+		int radius; tracker_settings.Get(PT_REFINEMENT_RADIUS, radius);
+		search_size_override_[MAP_SIZE_HALF] = std::min(getSearchSize(MAP_SIZE_HALF), template_size + 2 * radius);
+		search_size_override_[MAP_SIZE_FULL] = std::min(getSearchSize(MAP_SIZE_FULL), template_size + 2 * radius);
 	}
-	else{
-		current_frame = current_frame_quarter_;
-		tracker_settings.Get(PT_SUPPORT_AREA_SEARCH_SIZE_QUARTER, support_area_search_size);
+
+	bool prediction; tracker_settings.Get(PT_MOTION_PREDICTION, prediction);
+	if (prediction)
+	{
+		//The features move opposite to the viewpoint
+		predicted_motion_ = motion_model_.Predict();
+		search_offset_ = -predicted_motion_;
+
+		//Search only as far from the predicted position as the prediction tends to be wrong, three times the
+		//typical error plus a pixel for rounding, but never further than the search size in the settings
+		bool adaptive; tracker_settings.Get(PT_ADAPTIVE_SEARCH_SIZE, adaptive);
+		if (adaptive)
+		{
+			float factor = firstMapSize == MAP_SIZE_FULL ? 1.f : (firstMapSize == MAP_SIZE_HALF ? 2.f : 4.f);
+			int radius = (int)std::ceil(3 * motion_model_.GetUncertainty() / factor) + 1;
+			search_size_override_[firstMapSize] = std::min(getSearchSize(firstMapSize), template_size + 2 * radius);
+		}
 	}
+	used_search_size_ = getSearchSize(firstMapSize);
+}
+
+void PanoramaTracker::endMotionPrediction(bool sufficientQuality)
+{
+	//The model is updated also without PT_MOTION_PREDICTION, since the frame pipeline predicts the orientations with it.
+	//A frame with bad tracking would teach the model a wrong motion, so start over after it
+	if (sufficientQuality) motion_model_.Update(measured_motion_);
+	else motion_model_.Reset();
+}
+
+bool PanoramaTracker::getSearchOrigin(Point ptMap, MapSize mapSize, Point &searchOrigin) const
+{
+	int template_size; tracker_settings.Get(PT_SUPPORT_AREA_SIZE, template_size);
+	int support_area_search_size = getSearchSize(mapSize);
+	Mat current_frame = getCurrentFrame(mapSize);
+	Rect view_point = viewpoint_.GetViewpoint(mapSize);
 
-	view_point = viewpoint_.GetViewpoint(mapSize);
-	
 	//Origin point (top left) for the support area that is extracted,
 	//i.e. the area around the feature which is used as the template
 	Point tmplt_origin;
-	tmplt_origin.x = feature.pt_map.x - template_size / 2;
-	tmplt_origin.y = feature.pt_map.y - template_size / 2;
+	tmplt_origin.x = ptMap.x - template_size / 2;
+	tmplt_origin.y = ptMap.y - template_size / 2;
 
 	//Check that the area from which the templae is searched for is completely inside the current frame
 	//Get the x- and y- coordinates of top left corner of the extractable area
-	Point sprt_area_origin;
-	sprt_area_origin.x = (template_size / 2) + tmplt_origin.x - view_point.x - support_area_search_size / 2;
-	sprt_area_origin.y = (template_size / 2) + tmplt_origin.y - view_point.y - support_area_search_size / 2;
+	//The search area is moved by the predicted movement of the feature
+	Point offset = getSearchOffset(mapSize);
+	searchOrigin.x = (template_size / 2) + tmplt_origin.x - view_point.x - support_area_search_size / 2 + offset.x;
+	searchOrigin.y = (template_size / 2) + tmplt_origin.y - view_point.y - support_area_search_size / 2 + offset.y;
+
+	//If the search area goes across the current frame borders, the template can't be tracked
+	return !(searchOrigin.x < 0 || searchOrigin.x + support_area_search_size >= current_frame.cols
+		|| searchOrigin.y < 0 || searchOrigin.y + support_area_search_size >= current_frame.rows);
+}
+
+bool PanoramaTracker::matchTemplates(Point ptMap, MapSize mapSize, FeatureMatch &match) const
+{
+	//Try to find the feature around the area where it was during the previous frame
+	int template_size;
+	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, template_size);
+	int support_area_search_size = getSearchSize(mapSize);
 
 	//If the search area goes across the current frame borders, return false (failed tracking of this template)
-	if (sprt_area_origin.x < 0 || sprt_area_origin.x + support_area_search_size >= current_frame.cols
-		|| sprt_area_origin.y < 0 || sprt_area_origin.y + support_area_search_size >= current_frame.rows)
+	Point sprt_area_origin;
+	match.matched = false;
+	match.rotation_match = false;
+	match.movement_x = 0;
+	match.movement_y = 0;
+	match.quality = 1;
+	if (!getSearchOrigin(ptMap, mapSize, sprt_area_origin))
 	{
-		movementX = 0;
-		movementY = 0;
-		qualityVal = 1;
 		return false;
 	}
 
-	//Get the actual template around the feature from the map
-	Mat feature_template;
-	feature.GetTemplate(template_size, panorama_map.GetMap(mapSize), feature_template);
+	//Get the actual template around the feature from the map. It is inside the cell of the feature, so it is read from a single tile
+	Mat feature_template = panorama_map.GetRegion(Rect(ptMap.x - template_size / 2, ptMap.y - template_size / 2, template_size, template_size), mapSize);
 
 	//Get the support area from which the template is searched from the current image
-	Mat map_in_abs_pt = current_frame(Rect(sprt_area_origin.x, sprt_area_origin.y, support_area_search_size, support_area_search_size));
+	Mat map_in_abs_pt = getCurrentFrame(mapSize)(Rect(sprt_area_origin.x, sprt_area_origin.y, support_area_search_size, support_area_search_size));
 
-	//Match templates together
-	Mat result(map_in_abs_pt.cols - feature_template.cols + 1, map_in_abs_pt.rows - feature_template.rows + 1, CV_32FC1);
+	bool subpixel; tracker_settings.Get(PT_SUBPIXEL_REFINEMENT, subpixel);
+
+	//CV_TM_SQDIFF_NORMED on grayscale images is scored with the exact scorer of the batched matcher, so that both paths give
+	//identical results. The scorer and its buffers are reused by the following matches of the same thread
+	if (template_matching_type == CV_TM_SQDIFF_NORMED && map_in_abs_pt.type() == CV_8UC1 && feature_template.type() == CV_8UC1)
+	{
+		static thread_local TemplateMatcher scorer;
+		TemplateMatcher::MatchResult result = scorer.Match(map_in_abs_pt, feature_template, subpixel);
+		finishMatch(mapSize, result.subpixel_loc, result.quality, match);
+		return true;
+	}
+
+	//Match templates together. The result is reused by the following matches of the same thread
+	static thread_local Mat result;
 	matchTemplate(map_in_abs_pt, feature_template, result, template_matching_type);
 	double min_val; double max_val; Point min_loc; Point max_loc;
 	Point match_loc;
+	float qualityVal;
 
 	//Get the best location, according to what template matching type is used
 	//Some template matching methods use 1 as the best value and 0 as worst, and some vice versa
@@ -850,106 +1495,164 @@ bool PanoramaTracker::matchTemplates(PtFeature &feature, MapSize mapSize, float
 		qualityVal = max_val;
 	}
 
+	//The sub-pixel peak is interpolated from the neighbouring values of the result
+	Point2f refined_loc(match_loc.x, match_loc.y);
+	if (subpixel) refined_loc = TemplateMatcher::RefinePeak(result, match_loc);
+	finishMatch(mapSize, refined_loc, qualityVal, match);
+	return true;
+}
+
+void PanoramaTracker::matchTemplatesBatched(const FeatureStore &store, const std::vector<int> &slots, MapSize mapSize, std::vector<FeatureMatch> &matches)
+{
+	int template_size;
+	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, template_size);
+	int support_area_search_size = getSearchSize(mapSize);
+
+	//Create a job for every feature that matchTemplates would match, and remember which job belongs to which feature.
+	//Like there, the parts of a template outside the map are read as zeros
+	std::vector<TemplateMatcher::MatchJob> &jobs = scratch_.jobs;
+	std::vector<int> &feature_jobs = scratch_.feature_jobs;
+	jobs.clear();
+	feature_jobs.assign(slots.size(), -1);
+	for (size_t k = 0; k < slots.size(); k++)
+	{
+		Point pt_map = store.pt_map[slots.at(k)];
+		TemplateMatcher::MatchJob job;
+		if (getSearchOrigin(pt_map, mapSize, job.search_origin))
+		{
+			job.tmplt = panorama_map.GetRegion(Rect(pt_map.x - template_size / 2, pt_map.y - template_size / 2, template_size, template_size), mapSize);
+			feature_jobs.at(k) = jobs.size();
+			jobs.push_back(job);
+		}
+	}
+
+	bool subpixel; tracker_settings.Get(PT_SUBPIXEL_REFINEMENT, subpixel);
+	std::vector<TemplateMatcher::MatchResult> &results = scratch_.results;
+	template_matcher_.MatchBatch(getCurrentFrame(mapSize), template_size, support_area_search_size, jobs, results, subpixel);
+
+	//Features without a job failed the tracking like in matchTemplates
+	matches.resize(slots.size());
+	for (size_t k = 0; k < slots.size(); k++)
+	{
+		FeatureMatch &match = matches.at(k);
+		match.matched = false;
+		match.rotation_match = false;
+		match.movement_x = 0;
+		match.movement_y = 0;
+		match.quality = 1;
+		if (feature_jobs.at(k) >= 0)
+		{
+			const TemplateMatcher::MatchResult &result = results.at(feature_jobs.at(k));
+			finishMatch(mapSize, result.subpixel_loc, result.quality, match);
+		}
+	}
+}
+
+void PanoramaTracker::finishMatch(MapSize mapSize, Point2f matchLoc, float qualityVal, FeatureMatch &match) const
+{
+	int template_size;
+	tracker_settings.Get(PT_SUPPORT_AREA_SIZE, template_size);
+	int support_area_search_size = getSearchSize(mapSize);
+
 	//Calculate the difference (movement) by checking how far from the middle the found point is
 	//If the camera has not moved the matchLoc should be in the middle of the mapInAbsPt
 
 	//Since match loc is the location of the top left corner of the found area
-	movementX = match_loc.x - support_area_search_size / 2 +template_size / 2;
-	movementY = match_loc.y - support_area_search_size / 2 +template_size / 2;
+	match.matched = true;
+	//The offset of the search area is part of the movement
+	Point offset = getSearchOffset(mapSize);
+	match.movement_x = matchLoc.x - support_area_search_size / 2 +template_size / 2 + offset.x;
+	match.movement_y = matchLoc.y - support_area_search_size / 2 +template_size / 2 + offset.y;
+	match.quality = qualityVal;
 
 	float minQ;
 	tracker_settings.Get(PT_MIN_TRACKING_QUALITY, minQ);
 
-	//If tracked quality is good enough, add all the points and their correspondences to vectors
-	//that can be used with estimateRigidTransform to estimate the rotation of the camera
+	//If tracked quality is good enough, the match can be used for estimating the rotation of the camera
 	bool rotInv; tracker_settings.Get(PT_ROTATION_INVARIANT, rotInv);
 	if (template_matching_type == CV_TM_SQDIFF || template_matching_type == CV_TM_SQDIFF_NORMED){
-		if (rotInv && qualityVal < minQ){
-			MatchedFeature ft;
-			ft.id = feature.GetId();
-			ft.movements = Point2d(movementX, movementY);
-			matched_features_.push_back(ft);
-		}
+		match.rotation_match = rotInv && qualityVal < minQ;
 	}
 	else
 	{
-		if (rotInv){
-			MatchedFeature ft;
-			ft.id = feature.GetId();
-			ft.movements = Point2d(movementX, movementY);
-			matched_features_.push_back(ft);
-		}
+		match.rotation_match = rotInv;
 	}
-
-	return true;
 }
 
-void PanoramaTracker::estimateRotation()
+bool PanoramaTracker::estimateSimilarity(MapSize mapSize, Point2f &movement, float &roll)
 {
-	debug_timer_.StartTimer("EstimateRotation");
-
-	//First get the set of features from the full sized map
-	//Find keypoints in visible cells to a vector
-	std::vector<PtFeature> visibleFeatures;
-	std::vector<Point> visibleFeaturesPt, matchedFeaturesPt;
-	for (int i = 0; i < NO_OF_CELLS_X; i++){
-		for (int j = 0; j < NO_OF_CELLS_Y; j++){
-			if (cell_manager_.CellVisible(i, j, viewpoint_.GetViewpoint(MAP_SIZE_FULL))){
-				std::vector<PtFeature> appendaple = cell_manager_.GetCellKeypoints(i, j, PtFeature::KP_FULL_MAP);
-				visibleFeatures.insert(visibleFeatures.end(), appendaple.begin(), appendaple.end());
-			}
-		}
-	}
-
-	//Calculate medians for x and y movements for filtering purposes
-	std::vector<float> x_movements, y_movements;
-	for (MatchedFeature m : matched_features_){
-		x_movements.push_back(m.movements.x);
-		y_movements.push_back(m.movements.y);
-	}
-	float x_med = HelpFunctions::calculateMedian(x_movements);
-	float y_med = HelpFunctions::calculateMedian(y_movements);
-
-	//Add both matched features and features in the viewpoint to vectors as Point2d
-	for (PtFeature f : visibleFeatures){
-		for (MatchedFeature m : matched_features_){
-			if (f.GetId() == m.id && abs(m.movements.x - x_med) < 3 && abs(m.movements.y - y_med) < 3){
-				Point2d vpt(f.pt_map.x - viewpoint_.x, f.pt_map.y - viewpoint_.y);
-				matchedFeaturesPt.push_back(Point2d(vpt.x + m.movements.x, vpt.y + m.movements.y));
-				visibleFeaturesPt.push_back(vpt);
-			}
+	debug_timer_.StartTimer("EstimateSimilarity");
+
+	std::vector<Point2f> &visibleFeaturesPt = scratch_.visible_points, &matchedFeaturesPt = scratch_.matched_points;
+	visibleFeaturesPt.clear();
+	matchedFeaturesPt.clear();
+
+	//Add the features that are still in a visible cell, relative to the center of the viewpoint the movements were
+	//measured from, and the positions where they were found in the current frame
+	Rect view_point = viewpoint_.GetViewpoint(mapSize);
+	Point2f center(view_point.x + view_point.width / 2.f, view_point.y + view_point.height / 2.f);
+	for (const MatchedFeature &m : matched_features_){
+		if (!m.removed && visible_cells_.Contains(m.cell.x, m.cell.y)){
+			Point2f vpt(m.pt_map.x - center.x, m.pt_map.y - center.y);
+			visibleFeaturesPt.push_back(vpt);
+			matchedFeaturesPt.push_back(Point2f(vpt.x + m.movements.x, vpt.y + m.movements.y));
 		}
 	}
 
-	float rotation = 0;
-	//If there aren't enough visible features, don't estimate the rotation since the quality of the estimation
-	//will be insufficient
-	if (visibleFeaturesPt.size() > 15){
-		Mat_<float> result_mat = estimateRigidTransform(visibleFeaturesPt, matchedFeaturesPt, false);
-		if (result_mat.data){
-			rotation = atan2(result_mat.at<float>(1, 0), result_mat.at<float>(0, 0)) * 180 / M_PI;
-		}
+	//If there aren't enough visible features, or most of them disagree, the estimate is not reliable
+	SimilarityEstimator::Similarity similarity;
+	bool estimated = visibleFeaturesPt.size() > 15
+		&& similarity_estimator_.Estimate(visibleFeaturesPt, matchedFeaturesPt, similarity)
+		&& similarity_estimator_.GetInlierCount() * 2 >= (int)visibleFeaturesPt.size();
+	if (estimated)
+	{
+		//The translation is the movement of a feature at the center of the viewpoint
+		movement = similarity.translation;
+		roll = similarity.angle * 180 / M_PI;
 	}
-	
-	z_rotation_ -= rotation;
-	debug_timer_.StopTimer("EstimateRotation");
+	debug_timer_.StopTimer("EstimateSimilarity");
+	return estimated;
 }
 
 void PanoramaTracker::updateMap()
 {
 	debug_timer_.StartTimer("UpdateMap");
 
+	//With the mapping thread, only hand over copies of the frame data. The thread is started for the first update
+	//of a new map, or after the tracker has been moved
+	bool background_mapping; tracker_settings.Get(PT_BACKGROUND_MAPPING, background_mapping);
+	if (background_mapping && !mapping_worker_)
+	{
+		startMapping();
+	}
+	if (mapping_worker_)
+	{
+		MappingWorker::Job job;
+		job.viewpoint = viewpoint_;
+		job.frame = current_frame_.clone();
+		job.view_mask = panorama_map.GetMask(PanoramaMap::MASK_CURRENT).clone();
+		mapping_worker_->Submit(job);
+		debug_timer_.StopTimer("UpdateMap");
+		return;
+	}
+
 	//Get all cells that are visible, but not yet filled
-	std::vector<Point> unset_cells = cell_manager_.GetUnsetVisibleCells(viewpoint_.GetViewpoint(MAP_SIZE_FULL));
+	std::vector<Point> unset_cells;
+	for (Point cell : visible_cells_)
+	{
+		if (!cell_manager_.Status(cell.x, cell.y))
+		{
+			unset_cells.push_back(cell);
+		}
+	}
 	bool pyr; tracker_settings.Get(PT_PYRAMIDICAL, pyr);
 	bool cell_prev, cell_new;
-	Mat mapMask = panorama_map.GetMask(PanoramaMap::MASK_MAP);
 	for (size_t i = 0; i < unset_cells.size(); i++)
 	{
 		//Get the status of the cell, then update the status and get the new status.
 		//If the status has changed, save the coordinates of the changed cell. 
 		cell_prev = cell_manager_.Status(unset_cells.at(i).x, unset_cells.at(i).y);
-		cell_manager_.UpdateCellStatus(unset_cells.at(i).x, unset_cells.at(i).y, mapMask);
+		cell_manager_.UpdateCellStatus(unset_cells.at(i).x, unset_cells.at(i).y, panorama_map.GetCoverage());
 		cell_new = cell_manager_.Status(unset_cells.at(i).x, unset_cells.at(i).y);
 
 		//If the status changed, push the coordinates of the cell and its contents to vector
@@ -981,7 +1684,7 @@ void PanoramaTracker::updateViewpointLocation(float x_move, float y_move)
 	debug_timer_.StartTimer("updateViewpointLocation");
 	//If the loop closing has not been done, move the viewpoint to the correct location 
 	if (!panorama_map.IsClosed()){
-		viewpoint_.updateViewpointLocation(x_move, y_move, panorama_map.GetWidth(), panorama_map.GetHeight(), panorama_map.GetMask(PanoramaMap::MASK_MAP));
+		viewpoint_.updateViewpointLocation(x_move, y_move, panorama_map.GetWidth(), panorama_map.GetHeight());
 	}
 	//If the loop closing is finished, some additional steps are required
 	else
@@ -990,32 +1693,38 @@ void PanoramaTracker::updateViewpointLocation(float x_move, float y_move)
 		panorama_map.GetJumpLimits(max, min);
 		//If the viewpoint has gone "over" the limits of the jumping point, move the viewpoint over
 		//to the other side of the map
-		if (viewpoint_.x + x_move > max)
+		if (viewpoint_.precise_x + x_move > max)
 		{
-			viewpoint_.updateViewpointLocationCnst(min, viewpoint_.y);
+			viewpoint_.updateViewpointLocationCnst(min, viewpoint_.precise_y);
 		}
 
-		else if (viewpoint_.x + x_move < min)
+		else if (viewpoint_.precise_x + x_move < min)
 		{
-			viewpoint_.updateViewpointLocationCnst(max, viewpoint_.y);
+			viewpoint_.updateViewpointLocationCnst(max, viewpoint_.precise_y);
 		}
 
 		//Otherwise update normally
 		else
 		{
-			viewpoint_.updateViewpointLocation(x_move, y_move, panorama_map.GetWidth(), panorama_map.GetHeight(), panorama_map.GetMask(PanoramaMap::MASK_MAP));
+			viewpoint_.updateViewpointLocation(x_move, y_move, panorama_map.GetWidth(), panorama_map.GetHeight());
 		}
 	}
+	updateVisibleCells();
 	updateRotations();
 	debug_timer_.StopTimer("updateViewpointLocation");
 }
 
+void PanoramaTracker::updateVisibleCells()
+{
+	visible_cells_ = cell_manager_.GetVisibleCells(viewpoint_.GetViewpoint(MAP_SIZE_FULL));
+}
+
 
 void PanoramaTracker::updateRotations()
 {
 	//Calculate the new x and y rotation values according to the location of the viewpoint
-	x_rotation_ = pixelsToDegreesX(viewpoint_.x + viewpoint_.width / 2);
-	float a = (viewpoint_.y + viewpoint_.height / 2);
+	x_rotation_ = pixelsToDegreesX(viewpoint_.precise_x + viewpoint_.width / 2);
+	float a = (viewpoint_.precise_y + viewpoint_.height / 2);
 	float perc_of_map = a / panorama_map.GetHeight();
 	float p = perc_of_map * map_vertical_degrees_;
 	y_rotation_ = (p - map_vertical_degrees_ / 2);
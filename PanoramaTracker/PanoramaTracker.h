@@ -8,7 +8,9 @@
 #include <opencv2/ml/ml.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <list>
+#include <unordered_map>
 #include "HelpFunctions.h"
+#include "OrderStatistics.h"
 #include <chrono>
 #include <memory>
 #include <iomanip>
@@ -17,9 +19,19 @@
 #include "ImageWarper.h"
 #include "PtSettings.h"
 #include "Relocalizer.h"
+#include "RelocalizationWorker.h"
+#include "MappingWorker.h"
+#include "FramePipeline.h"
+#include "WorkerHandle.h"
 #include "DebugTimer.h"
 #include "CellManager.h"
 #include "Viewpoint.h"
+#include "TemplateMatcher.h"
+#include "MotionModel.h"
+#include "SimilarityEstimator.h"
+#include "DirectAligner.h"
+#include "GridFastDetector.h"
+#include "AllocationCounter.h"
 
 #define MAP_WINDOW "Map"
 
@@ -29,17 +41,35 @@ using namespace cv;
 //all the cells and their statuses
 class PanoramaTracker
 {
+	//Background threads working on this tracker. Declared first, so moving or assigning a tracker stops them
+	//before anything they use is moved or overwritten. The destructor stops them before the other members are destroyed
+	WorkerHandle<MappingWorker> mapping_worker_;	//Map updates, used with PT_BACKGROUND_MAPPING
+	WorkerHandle<FramePipeline> frame_pipeline_;	//Frame preparation, used with CalculateOrientationPipelined
 
 public:
 
-	//Structure for a feature that has been matched. Contains the ID of the feature, as well as its x and y movements as a Point2d
+	//Structure for a feature that has been matched. Contains the ID of the feature, as well as its x and y movements as a Point2d.
+	//The map point and cell of the feature are stored so the feature does not have to be looked up again
 	struct MatchedFeature{
 		Point2d movements;
 		int id;
+		Point pt_map;
+		Point cell;
+		bool removed;	//The feature was removed from its cell after matching
+	};
+	
+	//Result of template matching a single feature
+	struct FeatureMatch{
+		bool matched;
+		bool rotation_match;	//Good enough to be used in rotation estimation
+		float movement_x;
+		float movement_y;
+		float quality;
 	};
 	
 	enum TrackingStatus{ TRACKING_KEYPOINTS, RELOCALIZING, STOPPED };
 	bool debug_match_templates = false;
+	bool debug_warp_check = false;
 
 	PtSettings tracker_settings;
 	TrackingStatus tracking_status = TRACKING_KEYPOINTS;
@@ -49,6 +79,11 @@ public:
 	//Constructors with default settings and with custom settings
 	PanoramaTracker();
 	PanoramaTracker(PtSettings settings);
+	~PanoramaTracker();
+
+	//Moving stops the background threads of the moved-from tracker. The moved-to tracker starts its own when it needs them
+	PanoramaTracker(PanoramaTracker &&other) = default;
+	PanoramaTracker &operator=(PanoramaTracker &&other) = default;
 	
 
 	/*
@@ -58,7 +93,7 @@ public:
 	*/
 	void InitializeMap(Mat frame, bool mapReady, bool mapLoaded = false);
 
-	//View the map. Also return the map image for usage with plugins
+	//View the map. Also return the map image for usage with plugins. With moveMap only the shown part of the map is read
 	Mat ViewMap(MapSize mapSize, bool drawCells = true, bool drawKeypoints = false, bool showViewpoint = false, bool moveMap = false, bool onlyGet = false) const;	
 
 	//Get the map image with viewpoint drawn. Used for Unity integration
@@ -71,6 +106,24 @@ public:
 	//The function called each frame, which actually does the tracking and updates the orientation
 	void CalculateOrientation(Mat currentFrame);
 
+	/*
+	Pipelined version of CalculateOrientation. The frame is queued, and color converted and warped on a background
+	thread with the predicted orientation while an earlier frame is tracked. The oldest frame that has been prepared
+	is tracked, so the orientation lags the input by at least one frame. Returns false if no frame was tracked,
+	e.g. on the first call or when no frame had been prepared yet.
+	The queue size and the policy for dropping frames are set with PT_PIPELINE_QUEUE_SIZE and PT_PIPELINE_DROP_POLICY
+	*/
+	bool CalculateOrientationPipelined(Mat currentFrame);
+
+	//Number of frames dropped by the pipeline
+	int GetDroppedFrames() const;
+
+	/*
+	Heap allocations of the last tracked frame: its copy, warping and tracking, including the frame pipeline thread and
+	the template matching threads working for it. Always 0 unless compiled with PT_COUNT_ALLOCATIONS, see AllocationCounter.h
+	*/
+	long long GetFrameAllocations() const;
+
 	/*
 	Functions for setting an earlier relocalizer and panrama map.
 	Used for loading a previously saved map
@@ -109,8 +162,28 @@ private:
 
 	CellManager cell_manager_;
 	Viewpoint viewpoint_;
+
+	//Cells that are completely inside the viewpoint. Updated whenever the viewpoint changes
+	CellRange visible_cells_;
 	ImageWarper warper_;
+	//Warper of the frame pipeline thread, since the warp map cache is not shared between threads
+	ImageWarper pipeline_warper_;
 	DebugTimer debug_timer_;
+	TemplateMatcher template_matcher_;
+	SimilarityEstimator similarity_estimator_;
+	GridFastDetector grid_fast_detector_;	//Keypoint detector used with PT_GRID_FAST
+
+	/*
+	Direct alignment engine used with PT_DIRECT_ALIGNMENT and the iterations of the last frame. Its template is the
+	map at the anchor, kept until the viewpoint has moved an eighth of the frame from it or the map has changed,
+	so that the template, its mask and its pyramid are not built again every frame. direct_template_ is the gray
+	template of a colored map
+	*/
+	DirectAligner direct_aligner_;
+	Mat direct_template_;
+	Rect direct_anchor_;
+	int direct_anchor_version_ = -1;
+	int direct_iterations_ = 0;
 
 	//Used template matching type, CV_TM_SQDIFF_NORMED is the one that seems to work best
 	int template_matching_type = CV_TM_SQDIFF_NORMED;
@@ -130,6 +203,11 @@ private:
 	//Calculated automatically
 	int map_view_pixels_;
 
+	//The whole map colored for ViewMap, and the map size and version it was made from
+	mutable Mat view_map_cache_;
+	mutable MapSize view_map_cache_size_ = MAP_SIZE_FULL;
+	mutable int view_map_cache_version_ = -1;
+
 	//Width of the input image before warper scales it down
 	int initial_img_width_;
 
@@ -151,9 +229,13 @@ private:
 	//Different versions of the currently input image
 	Mat current_frame_;
 	Mat current_frame_non_warped_;
+	Mat current_frame_color_;
 	Mat current_frame_half_;
 	Mat current_frame_quarter_;
 
+	//The frame prepared by CalculateOrientation. It refers to the input frame, and its other buffers are reused by the next frame
+	FramePipeline::Frame serial_frame_;
+
 	/*
 	The quality and deviation during last frame. Set to 1000, but after
 	the start quality is actually a value in range 0..1 and deviation 0..10
@@ -161,11 +243,27 @@ private:
 	float average_quality_ = 1000; 
 	float deviation_ = 1000;
 
+	//Mean absolute pixel difference between the separable and the full warp, when debug_warp_check is on
+	float warp_check_error_ = 0;
+	//Warp map cache statistics of the warper that prepared the current frame
+	int warp_cache_hits_ = 0;
+	int warp_cache_misses_ = 0;
+
 	//The orientations returned by the tracker
 	float x_rotation_ = 0;
 	float y_rotation_ = 0;
 	float z_rotation_ = 0;
 
+	//Last orientation tracked with sufficient quality, used as the relocalization prior
+	float last_good_x_rotation_ = 0;
+	float last_good_y_rotation_ = 0;
+	//Number of failed relocalizations since tracking was lost, widens the search window
+	int failed_relocalizations_ = 0;
+
+	//Background relocalization, created on first use, and the relocalizer copy shared with it
+	std::shared_ptr<RelocalizationWorker> reloc_worker_;
+	std::shared_ptr<const Relocalizer> reloc_snapshot_;
+
 	//Variables used for determining when to do loop closing
 	float min_rotation_ = 10000;
 	float max_rotation_ = -10000;
@@ -177,6 +275,9 @@ private:
 	//Points used for rotation estimation
 	std::vector<MatchedFeature> matched_features_;
 
+	//Index of each feature id in matched_features_ as (id, index) pairs, sorted by id
+	std::vector<std::pair<int, int>> matched_index_;
+
 	//How many keypoints were used and dropped last frame
 	int used_kp_full_;
 	int used_kp_half_;
@@ -199,43 +300,192 @@ private:
 	float moved_deg_x_ = 0;	
 	float moved_deg_y_ = 0;
 
+	//Motion model of the viewpoint. Offsets the search areas with PT_MOTION_PREDICTION, and predicts the orientations of the pipelined frames
+	MotionModel motion_model_;
+	//Motion of the viewpoint predicted for the current frame, and the motion measured during it, in full map pixels
+	Point2f predicted_motion_;
+	Point2f measured_motion_;
+	//Expected movement of the features in full map pixels, added to the search areas of the first tracked map
+	Point2f search_offset_;
+	//Search sizes adapted to the prediction uncertainty for the current frame, 0 uses the size in the settings
+	int search_size_override_[3];
+	//Search size used with the first tracked map of the last frame
+	int used_search_size_ = 0;
+	//Features needed on a coarse map for the finer maps to use the small refinement search in coarse to fine mode
+	static const int min_coarse_features_ = 4;
+	//How many times a full map cell can be re-seeded from its cached keypoint candidates
+	static const int reseed_rounds_ = 3;
+
+	//The map written by the mapping thread, and the cells it has completed and published.
+	//Only accessed by the mapping thread while it runs
+	PanoramaMap mapping_map_;
+	bool mapped_cells_[NO_OF_CELLS_X][NO_OF_CELLS_Y];
+	//Frames waiting for the mapping thread
+	static const int max_mapping_jobs_ = 2;
+
+	/*
+	Temporary buffers of the tracking loop. They are cleared when used but keep their capacity,
+	so once they have grown to the number of tracked features a frame does not allocate
+	*/
+	struct FrameScratch
+	{
+		std::vector<float> qualities;		//Match qualities of all maps of the frame
+		std::vector<float> x_moves;			//Feature movements of the map being tracked
+		std::vector<float> y_moves;
+		std::vector<float> map_qualities;
+		std::vector<float> filtered_x;		//Movements left after filtering
+		std::vector<float> filtered_y;
+		std::vector<float> sorted;			//Selection space of the medians
+		std::vector<int> slots;				//Store slots of the tracked features
+		std::vector<FeatureMatch> matches;
+		std::vector<TemplateMatcher::MatchJob> jobs;
+		std::vector<int> feature_jobs;
+		std::vector<TemplateMatcher::MatchResult> results;
+		std::vector<Point2f> visible_points;	//Point pairs for the similarity estimation
+		std::vector<Point2f> matched_points;
+	};
+	FrameScratch scratch_;
+
+	//Allocations of the frame being tracked, and the total of the last tracked frame
+	AllocationCounter::Tally frame_tally_;
+	long long frame_allocations_ = 0;
+
+
+	//Template matches a range of features with parallel_for_. Each feature writes only to its own result
+	class MatchTemplatesBody : public ParallelLoopBody
+	{
+	public:
+		MatchTemplatesBody(PanoramaTracker *tracker, const FeatureStore &store, const std::vector<int> &slots, MapSize mapSize, std::vector<FeatureMatch> &matches);
+		void operator()(const Range &range) const;
+	private:
+		PanoramaTracker *tracker_;
+		const FeatureStore &store_;
+		const std::vector<int> &slots_;
+		MapSize map_size_;
+		std::vector<FeatureMatch> &matches_;
+	};
+
 	//Function called by both constructors
 	void construct();
 
+	//Create the warper according to the settings
+	void initWarper();
+
 	//Get FAST keypoints
 	std::vector<PtFeature> getKeypoints(int x, int y, MapSize mapSize);
 
+	/*
+	Get the FAST keypoints of cell x,y from its contents, without storing them. If candidates is given, the next best
+	keypoints are added to it, best first, for re-seeding the cell later
+	*/
+	std::vector<PtFeature> findKeypoints(const Mat &cellContents, int x, int y, MapSize mapSize, std::vector<PtFeature> *candidates = nullptr) const;
+
+	//Start the mapping thread for the current map
+	void startMapping();
+
+	//Mark the cells complete in the cell manager as mapped for the mapping thread
+	void syncMappedCells();
+
+	//Integrate a frame into the map of the mapping thread and find the keypoints of the completed cells. Runs on the mapping thread
+	void mapFrame(const MappingWorker::Job &job, MappingWorker::Result &result);
+
+	//Take the map and the cells published by the mapping thread into use
+	void installMappedCells();
+
 	//Estimate the new orientation_ of the camera from mapSize map_. Outputs vectors of all xMovements, yMovements and qualities of keypoints
 	void estimateOrientation(MapSize mapSize, std::vector<float> &xMovements, std::vector<float> &yMovements, std::vector<float> &qualities);
 
 	//Track the movement and update viewpoitn on the mapSize. Return the standard deviation for quality estimation
 	float trackAndUpdate(MapSize mapSize, std::vector<float> &allQualities);
 
+	/*
+	Track by aligning the whole current frame against the map at the anchor near the viewpoint (PT_DIRECT_ALIGNMENT) and
+	update the viewpoint. Adds the alignment error to allQualities and returns the deviation for quality estimation
+	*/
+	float trackDirect(std::vector<float> &allQualities);
+
 	//Update the qualities of the features, and remove features that have too low quality
-	void updateFeatures(MapSize mapSize, int medx, int medy);
+	void updateFeatures(MapSize mapSize, float medx, float medy);
 
 	//Update the cell to see if it still contains keypoints, or if it shold be re-searched
 	void updateCell(int x, int y);
 
 	//Do template matching for comparable area and predicted position of the keypoint.
-	//Output movement in x direction, movement in y direction and quality of the found template (max/min value of matchTemplate)
-	bool matchTemplates(PtFeature &feature, MapSize mapSize, float &movementX, float &movementY, float &qualityVal);
+	//Outputs the movement and the quality of the found template (max/min value of matchTemplate).
+	//Does not modify the tracker, so it can be called from several threads at once
+	bool matchTemplates(Point ptMap, MapSize mapSize, FeatureMatch &match) const;
+
+	//Template match all features at once with the batched matcher
+	void matchTemplatesBatched(const FeatureStore &store, const std::vector<int> &slots, MapSize mapSize, std::vector<FeatureMatch> &matches);
+
+	//Predicted movement of the features in the current frame on mapSize map, by which the search areas are offset
+	Point getSearchOffset(MapSize mapSize) const;
+
+	//Set up the search offsets and sizes of the maps before tracking a frame, starting with firstMapSize map
+	void setupSearchAreas(MapSize firstMapSize);
+
+	//Update the motion model with the measured motion after tracking a frame
+	void endMotionPrediction(bool sufficientQuality);
+
+	//Get the top left corner of the search area of the feature in the current frame. Returns false if it is not inside the frame
+	bool getSearchOrigin(Point ptMap, MapSize mapSize, Point &searchOrigin) const;
 
-	//Estimate the rotation around z-axis
-	void estimateRotation();
+	//Calculate the movement from the best match location, and check if the match can be used for rotation estimation
+	void finishMatch(MapSize mapSize, Point2f matchLoc, float qualityVal, FeatureMatch &match) const;
+
+	//Store the match of the feature in the slot to the store, to the output vectors of estimateOrientation and to matched_features_
+	void storeFeatureMatch(FeatureStore &store, int slot, const FeatureMatch &match,
+		std::vector<float> &xMovements, std::vector<float> &yMovements, std::vector<float> &qualities);
+
+	//Get the keypoint type tracked with mapSize
+	PtFeature::KeypointType getKeypointType(MapSize mapSize) const;
+
+	//Get the current frame and the template search size used with mapSize
+	Mat getCurrentFrame(MapSize mapSize) const;
+	int getSearchSize(MapSize mapSize) const;
+
+	/*
+	Estimate the movement of the features at the center of the viewpoint and the rotation around z-axis in degrees
+	together, from the features matched on mapSize. Returns false if there are not enough consistent features
+	*/
+	bool estimateSimilarity(MapSize mapSize, Point2f &movement, float &roll);
 
 	//Called every frame whenever the tracking is lost
 	void Relocalize();
+
+	//Poll the background relocalization and queue the current frame, used with PT_ASYNC_RELOCALIZATION
+	void relocalizeAsync();
+
+	//Relocalization search window in degrees around the last good orientation, 0 searches everywhere
+	float getRelocSearchWindow() const;
+
+	//Move the viewpoint to the relocalized orientation if quality is good enough. Return true if moved
+	bool applyRelocalization(float x, float y, float z, float quality);
 	
 	//Update map_ using cell based or mask based extending
 	void updateMap();
 
 	//Update all current frame instances and warp the image
 	void updateCurrentFrame(Mat frame);
+
+	//Color convert and warp frame.color with the orientation stored in frame. Also called from the pipeline thread, with its own warper and without timer
+	void prepareFrame(FramePipeline::Frame &frame, ImageWarper &warper, DebugTimer *timer);
+
+	//Use the prepared frame as the current frame
+	void installFrame(const FramePipeline::Frame &frame);
+
+	//Track the current frame, i.e. everything CalculateOrientation does after updating the frame
+	void trackCurrentFrame();
+
+	//Get the grayscale non warped frame, converting it from the color frame if the fused warp skipped it
+	Mat getNonWarpedFrame();
 	
 	//Move viewpoint to correct position using orientation_pixels_x_
 	void updateViewpointLocation(float x_move, float y_move);
 
+	//Update visible_cells_ to match the current viewpoint
+	void updateVisibleCells();
+
 	//Move the viewpoints to correct positions using the rotations
 	void updateRotations();
 	
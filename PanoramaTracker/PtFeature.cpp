@@ -1,6 +1,6 @@
 #include "PtFeature.h"
 
-int PtFeature::ids = 0;
+std::atomic<int> PtFeature::ids(0);
 
 PtFeature::PtFeature()
 : pt_cell(Point(0,0)),
@@ -19,15 +19,29 @@ movement_x(-1000),
 movement_y(-1000)
 {
 	//Generate running id for each feature
-	id = ids;
-	ids++;
+	id = ids++;
+}
+
+PtFeature::PtFeature(Point ptCell, Point ptMap, int id)
+: pt_cell(ptCell),
+pt_map(ptMap),
+quality(1),
+movement_x(-1000),
+movement_y(-1000),
+id(id)
+{
 }
 
 bool PtFeature::GetTemplate(int supportAreaSize, Mat map, Mat &supportArea) const
+{
+	return GetTemplate(pt_map, supportAreaSize, map, supportArea);
+}
+
+bool PtFeature::GetTemplate(Point ptMap, int supportAreaSize, Mat map, Mat &supportArea)
 {
 	Point suppAreaOrigin;
-	suppAreaOrigin.x = pt_map.x - supportAreaSize / 2;
-	suppAreaOrigin.y = pt_map.y - supportAreaSize / 2;
+	suppAreaOrigin.x = ptMap.x - supportAreaSize / 2;
+	suppAreaOrigin.y = ptMap.y - supportAreaSize / 2;
 
 	//Check all conditions
 	if (suppAreaOrigin.x >= 0 && suppAreaOrigin.x / 2 < map.cols
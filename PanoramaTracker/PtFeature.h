@@ -5,6 +5,7 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/ml/ml.hpp>
+#include <atomic>
 #include "PanoramaMap.h"
 
 using namespace cv;
@@ -17,19 +18,23 @@ public:
 	Point pt_map;	//Coordinates of the point in the map
 	float quality;	//Quality of the point from 0..1
 
-	int movement_x;	//Movement of the feature in the last frame, x
-	int movement_y;	//Movement of the feature in the last frame, y
+	float movement_x;	//Movement of the feature in the last frame, x
+	float movement_y;	//Movement of the feature in the last frame, y
 
 	PtFeature();
 	PtFeature(Point ptCell, Point ptMap);
+
+	//Constructor for an existing feature, keeps the given id
+	PtFeature(Point ptCell, Point ptMap, int id);
 	
 	//Get the area around the feature point from the map
 	bool GetTemplate(int supportAreaSize, Mat map, Mat &supportArea) const;
+	static bool GetTemplate(Point ptMap, int supportAreaSize, Mat map, Mat &supportArea);
 	int GetId() const;
 
 private:
-	//Used for id generation
-	static int ids;
+	//Used for id generation. Atomic, since features are also created by the mapping thread
+	static std::atomic<int> ids;
 	
 	//ID for each feature, used in rotation estimation to mach pairs of features
 	int id;
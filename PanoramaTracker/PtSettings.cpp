@@ -26,6 +26,26 @@ PtSettings::PtSettings()
 	use_android_shield_ = false;
 	pyramidical_ = false;
 	rotation_invariant_ = false;
+	use_warp_cache_ = false;
+	warp_cache_step_ = 0.1;
+	separable_warp_ = false;
+	fused_warp_ = false;
+	undistort_ = false;
+	batched_matching_ = false;
+	async_relocalization_ = false;
+	background_mapping_ = false;
+	motion_prediction_ = false;
+	adaptive_search_size_ = false;
+	coarse_to_fine_ = false;
+	refinement_radius_ = 2;
+	subpixel_refinement_ = false;
+	direct_alignment_ = false;
+	grid_fast_ = false;
+	//Number of stripes the template matching is split into on the OpenCV thread pool, 1 matches on the calling thread
+	tracking_threads_ = 1;
+	pipeline_queue_size_ = 2;
+	pipeline_drop_policy_ = 0;
+	reloc_search_window_ = 30;
 }
 
 void PtSettings::Set(SettingValue setting, double value)
@@ -65,6 +85,15 @@ void PtSettings::Set(SettingValue setting, double value)
 	case PT_MAX_KEYPOINTS_PER_CELL:
 		max_keypoints_per_cell_ = value;
 		break;
+	case PT_TRACKING_THREADS:
+		tracking_threads_ = value;
+		break;
+	case PT_PIPELINE_QUEUE_SIZE:
+		pipeline_queue_size_ = value;
+		break;
+	case PT_PIPELINE_DROP_POLICY:
+		pipeline_drop_policy_ = value;
+		break;
 	case PT_CELLS_X:
 		number_of_cells_x_ = value;
 		break;
@@ -104,6 +133,54 @@ void PtSettings::Set(SettingValue setting, double value)
 	case PT_MAX_DEV_FILTERING_FULL:
 		max_dev_filtering_full_ = value;
 		break;
+	case PT_USE_WARP_CACHE:
+		use_warp_cache_ = value;
+		break;
+	case PT_WARP_CACHE_STEP:
+		warp_cache_step_ = value;
+		break;
+	case PT_RELOC_SEARCH_WINDOW:
+		reloc_search_window_ = value;
+		break;
+	case PT_SEPARABLE_WARP:
+		separable_warp_ = value;
+		break;
+	case PT_FUSED_WARP:
+		fused_warp_ = value;
+		break;
+	case PT_UNDISTORT:
+		undistort_ = value;
+		break;
+	case PT_BATCHED_MATCHING:
+		batched_matching_ = value;
+		break;
+	case PT_ASYNC_RELOCALIZATION:
+		async_relocalization_ = value;
+		break;
+	case PT_BACKGROUND_MAPPING:
+		background_mapping_ = value;
+		break;
+	case PT_MOTION_PREDICTION:
+		motion_prediction_ = value;
+		break;
+	case PT_ADAPTIVE_SEARCH_SIZE:
+		adaptive_search_size_ = value;
+		break;
+	case PT_COARSE_TO_FINE:
+		coarse_to_fine_ = value;
+		break;
+	case PT_REFINEMENT_RADIUS:
+		refinement_radius_ = value;
+		break;
+	case PT_SUBPIXEL_REFINEMENT:
+		subpixel_refinement_ = value;
+		break;
+	case PT_DIRECT_ALIGNMENT:
+		direct_alignment_ = value;
+		break;
+	case PT_GRID_FAST:
+		grid_fast_ = value;
+		break;
 	default:
 		std::cout << "Invalid setting type!" << std::endl;
 		break;
@@ -145,6 +222,18 @@ void PtSettings::Get(SettingValue setting, int& value) const
 	case PT_MAX_KEYPOINTS_PER_CELL:
 		value = max_keypoints_per_cell_;
 		break;
+	case PT_TRACKING_THREADS:
+		value = tracking_threads_;
+		break;
+	case PT_PIPELINE_QUEUE_SIZE:
+		value = pipeline_queue_size_;
+		break;
+	case PT_PIPELINE_DROP_POLICY:
+		value = pipeline_drop_policy_;
+		break;
+	case PT_REFINEMENT_RADIUS:
+		value = refinement_radius_;
+		break;
 	case PT_MAX_DEVIATION:
 		value = max_deviation_;
 		break;
@@ -191,6 +280,45 @@ void PtSettings::Get(SettingValue setting, bool& value) const
 	case PT_ROTATION_INVARIANT:
 		value = rotation_invariant_;
 		break;
+	case PT_USE_WARP_CACHE:
+		value = use_warp_cache_;
+		break;
+	case PT_SEPARABLE_WARP:
+		value = separable_warp_;
+		break;
+	case PT_FUSED_WARP:
+		value = fused_warp_;
+		break;
+	case PT_UNDISTORT:
+		value = undistort_;
+		break;
+	case PT_BATCHED_MATCHING:
+		value = batched_matching_;
+		break;
+	case PT_ASYNC_RELOCALIZATION:
+		value = async_relocalization_;
+		break;
+	case PT_BACKGROUND_MAPPING:
+		value = background_mapping_;
+		break;
+	case PT_MOTION_PREDICTION:
+		value = motion_prediction_;
+		break;
+	case PT_ADAPTIVE_SEARCH_SIZE:
+		value = adaptive_search_size_;
+		break;
+	case PT_COARSE_TO_FINE:
+		value = coarse_to_fine_;
+		break;
+	case PT_SUBPIXEL_REFINEMENT:
+		value = subpixel_refinement_;
+		break;
+	case PT_DIRECT_ALIGNMENT:
+		value = direct_alignment_;
+		break;
+	case PT_GRID_FAST:
+		value = grid_fast_;
+		break;
 	default:
 		std::cout << "Invalid setting type!" << std::endl;
 		break;
@@ -207,6 +335,12 @@ void PtSettings::Get(SettingValue setting, float& value) const
 	case PT_MIN_RELOC_QUALITY:
 		value = min_relocalization_quality_;
 		break;
+	case PT_WARP_CACHE_STEP:
+		value = warp_cache_step_;
+		break;
+	case PT_RELOC_SEARCH_WINDOW:
+		value = reloc_search_window_;
+		break;
 	default:
 		std::cout << "Invalid setting type!" << std::endl;
 		break;
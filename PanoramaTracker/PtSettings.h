@@ -3,6 +3,8 @@
 //Define for removing all console logging and imshows
 //Mainly to be used in the Android plugin for Unity
 #define DEBUG_BUILD 
+//Define for counting the heap allocations of each tracked frame, see AllocationCounter.h
+//#define PT_COUNT_ALLOCATIONS
 
 enum SettingValue
 {
@@ -11,7 +13,12 @@ enum SettingValue
 	PT_SUPPORT_AREA_SEARCH_SIZE_QUARTER, PT_FAST_KEYPOINT_THRESHOLD, PT_MAX_KEYPOINTS_PER_CELL,
 	PT_USE_COLORED_MAP, PT_USE_ORB, PT_MIN_TRACKING_QUALITY, PT_MAX_DEVIATION, PT_MIN_RELOC_QUALITY,
 	PT_CELLS_X, PT_CELLS_Y, PT_USE_ANDROID_SHIELD, PT_WARPER_SCALE, PT_PYRAMIDICAL, PT_ROTATION_INVARIANT,
-	PT_MAX_DEV_FILTERING_FULL, PT_MAX_DEV_FILTERING_HALF, PT_MAX_DEV_FILTERING_QUARTER
+	PT_MAX_DEV_FILTERING_FULL, PT_MAX_DEV_FILTERING_HALF, PT_MAX_DEV_FILTERING_QUARTER,
+	PT_USE_WARP_CACHE, PT_WARP_CACHE_STEP, PT_SEPARABLE_WARP, PT_FUSED_WARP, PT_UNDISTORT,
+	PT_BATCHED_MATCHING, PT_TRACKING_THREADS, PT_RELOC_SEARCH_WINDOW,
+	PT_ASYNC_RELOCALIZATION, PT_BACKGROUND_MAPPING, PT_PIPELINE_QUEUE_SIZE, PT_PIPELINE_DROP_POLICY,
+	PT_MOTION_PREDICTION, PT_ADAPTIVE_SEARCH_SIZE, PT_COARSE_TO_FINE, PT_REFINEMENT_RADIUS,
+	PT_SUBPIXEL_REFINEMENT, PT_DIRECT_ALIGNMENT, PT_GRID_FAST
 };
 
 /*
@@ -47,9 +54,28 @@ private:
 	int max_dev_filtering_quarter_;
 	float min_tracking_quality_;
 	float min_relocalization_quality_;
+	float warp_cache_step_;
+	float reloc_search_window_;
 	bool use_colored_map_;
 	bool use_orb_;
 	bool use_android_shield_;
 	bool pyramidical_;
 	bool rotation_invariant_;
+	bool use_warp_cache_;
+	bool separable_warp_;
+	bool fused_warp_;
+	bool undistort_;
+	bool batched_matching_;
+	bool async_relocalization_;
+	bool background_mapping_;
+	bool motion_prediction_;
+	bool adaptive_search_size_;
+	bool coarse_to_fine_;
+	bool subpixel_refinement_;
+	bool direct_alignment_;
+	bool grid_fast_;
+	int tracking_threads_;
+	int pipeline_queue_size_;
+	int pipeline_drop_policy_;
+	int refinement_radius_;
 };
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "RelocalizationWorker.h"
+
+RelocalizationWorker::RelocalizationWorker()
+{
+	thread_ = std::thread(&RelocalizationWorker::run, this);
+}
+
+RelocalizationWorker::~RelocalizationWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void RelocalizationWorker::Submit(std::shared_ptr<const Relocalizer> relocalizer, Mat frame, float prior_x, float prior_y, float window)
+{
+	//Copy outside the lock, the caller keeps writing to its frame buffers
+	Request request;
+	request.relocalizer = relocalizer;
+	request.frame = frame.clone();
+	request.prior_x = prior_x;
+	request.prior_y = prior_y;
+	request.window = window;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		request_ = request;
+		has_request_ = true;
+	}
+	wake_.notify_one();
+}
+
+bool RelocalizationWorker::PollResult(Result &result)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!has_result_) return false;
+	result = result_;
+	has_result_ = false;
+	return true;
+}
+
+void RelocalizationWorker::Cancel()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	has_request_ = false;
+	has_result_ = false;
+	request_ = Request();
+	generation_++;
+}
+
+bool RelocalizationWorker::Busy() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return has_request_ || running_;
+}
+
+void RelocalizationWorker::run()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		wake_.wait(lock, [this]{ return stop_ || has_request_; });
+		if (stop_) return;
+
+		Request request = request_;
+		request_ = Request();
+		has_request_ = false;
+		running_ = true;
+		int generation = generation_;
+		lock.unlock();
+
+		Result result;
+		request.relocalizer->Relocalize(request.frame, request.prior_x, request.prior_y, request.window,
+			result.x_rot, result.y_rot, result.z_rot, result.quality);
+
+		lock.lock();
+		running_ = false;
+		if (generation == generation_)
+		{
+			result_ = result;
+			has_result_ = true;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "Relocalizer.h"
+
+using namespace cv;
+
+/*
+Runs relocalization on a background thread so the frame loop does not block while tracking is lost.
+Only the latest submitted request is kept: a request that has not started yet is replaced by a newer one,
+and results of requests submitted before Cancel are dropped
+*/
+class RelocalizationWorker
+{
+public:
+	struct Result
+	{
+		float x_rot;
+		float y_rot;
+		float z_rot;
+		float quality;
+	};
+
+	RelocalizationWorker();
+	~RelocalizationWorker();
+
+	RelocalizationWorker(const RelocalizationWorker&) = delete;
+	RelocalizationWorker &operator=(const RelocalizationWorker&) = delete;
+
+	//Queue frame for relocalization against relocalizer. The frame is copied, and relocalizer
+	//must not be modified while it is shared with the worker
+	void Submit(std::shared_ptr<const Relocalizer> relocalizer, Mat frame, float prior_x, float prior_y, float window);
+
+	//Return true and the result if a request has finished since the last call
+	bool PollResult(Result &result);
+
+	//Drop the pending request and any result not yet polled
+	void Cancel();
+
+	//True if a request is pending or running
+	bool Busy() const;
+private:
+	struct Request
+	{
+		std::shared_ptr<const Relocalizer> relocalizer;
+		Mat frame;
+		float prior_x;
+		float prior_y;
+		float window;
+	};
+
+	void run();
+
+	mutable std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread thread_;
+
+	bool stop_ = false;
+	bool has_request_ = false;
+	bool running_ = false;
+	bool has_result_ = false;
+	//Incremented by Cancel, a result is only kept if the generation did not change while it was computed
+	int generation_ = 0;
+	Request request_;
+	Result result_;
+};
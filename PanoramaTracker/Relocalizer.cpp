@@ -1,5 +1,36 @@
 #include "Relocalizer.h"
 
+namespace
+{
+	//Dot product of two uchar rows
+	int64 dotRow(const uchar *a, const uchar *b, int len)
+	{
+		int64 dot = 0;
+		int x = 0;
+#if CV_SIMD128
+		//Accumulate in blocks small enough that the 32-bit lanes can't overflow
+		const int block = 8 * 4096;
+		while (x <= len - 8)
+		{
+			int block_end = std::min(len - 8, x + block);
+			v_int32x4 v_dot = v_setzero_s32();
+			for (; x <= block_end; x += 8)
+			{
+				v_int16x8 va = v_reinterpret_as_s16(v_load_expand(a + x));
+				v_int16x8 vb = v_reinterpret_as_s16(v_load_expand(b + x));
+				v_dot += v_dotprod(va, vb);
+			}
+			dot += v_reduce_sum(v_dot);
+		}
+#endif
+		for (; x < len; x++)
+		{
+			dot += a[x] * b[x];
+		}
+		return dot;
+	}
+}
+
 void Relocalizer::addRelocalizationPoint(Mat image, float x_rot, float y_rot, float z_rot)
 {
 	//Resize and blur the input images. Small blurred images are "easier" to match
@@ -7,7 +38,25 @@ void Relocalizer::addRelocalizationPoint(Mat image, float x_rot, float y_rot, fl
 	Mat resized_img, blurred_img;
 	resize(image, resized_img, Size(reloc_image_width_, reloc_image_height_));
 	blurImage(resized_img, blurred_img);
-	relocalization_points.push_back(RelocalizerPoint(blurred_img, x_rot, y_rot, z_rot));
+	addToBank(blurred_img, x_rot, y_rot, z_rot);
+}
+
+void Relocalizer::addToBank(const Mat &image, float x_rot, float y_rot, float z_rot)
+{
+	CV_Assert(image.type() == CV_8UC1 && image.cols == reloc_image_width_ && image.rows == reloc_image_height_);
+	Mat thumb;
+	resize(image, thumb, Size(thumb_width_, thumb_height_), 0, 0, INTER_AREA);
+	appendRow(image, bank_, bank_norms_);
+	appendRow(thumb, thumb_bank_, thumb_norms_);
+	relocalization_points.push_back(RelocalizerPoint(x_rot, y_rot, z_rot));
+}
+
+void Relocalizer::appendRow(const Mat &image, Mat &bank, std::vector<double> &norms)
+{
+	Mat row = image.clone().reshape(1, 1);
+	//Mat::push_back grows the storage geometrically, so the bank stays contiguous
+	bank.push_back(row);
+	norms.push_back(std::sqrt((double)dotRow(row.ptr<uchar>(), row.ptr<uchar>(), row.cols)));
 }
 
 void Relocalizer::AddRelocImage(Mat image, float x_rot, float y_rot, float z_rot)
@@ -16,19 +65,88 @@ void Relocalizer::AddRelocImage(Mat image, float x_rot, float y_rot, float z_rot
 }
 
 void Relocalizer::Relocalize(Mat image, float& x_rot, float& y_rot, float& z_rot, float &quality) const
+{
+	Relocalize(image, 0, 0, 0, x_rot, y_rot, z_rot, quality);
+}
+
+void Relocalizer::Relocalize(Mat image, float prior_x, float prior_y, float window, float& x_rot, float& y_rot, float& z_rot, float& quality) const
 {
 	//Get the best match and return it
-	RelocalizerPoint pt = relocalize(image, quality);
-	x_rot = pt.x_angle;
-	y_rot = pt.y_angle;
-	z_rot = pt.z_angle;
+	std::vector<Candidate> candidates;
+	relocalize(image, 1, prior_x, prior_y, window, candidates);
+	if (candidates.empty())
+	{
+		x_rot = y_rot = z_rot = 0;
+		quality = 100;
+		return;
+	}
+	x_rot = candidates.front().x_rot;
+	y_rot = candidates.front().y_rot;
+	z_rot = candidates.front().z_rot;
+	quality = candidates.front().quality;
+}
+
+void Relocalizer::RelocalizeCandidates(Mat image, int k, std::vector<Candidate>& candidates) const
+{
+	relocalize(image, k, 0, 0, 0, candidates);
+}
+
+void Relocalizer::relocalize(Mat image, int k, float prior_x, float prior_y, float window, std::vector<Candidate>& candidates) const
+{
+	candidates.clear();
+	if (relocalization_points.empty() || k <= 0)
+	{
+		return;
+	}
+
+	//Only consider points near the prior rotation. x wraps around the full circle
+	std::vector<int> rows;
+	rows.reserve(relocalization_points.size());
+	for (size_t i = 0; i < relocalization_points.size(); i++)
+	{
+		const RelocalizerPoint &pt = relocalization_points[i];
+		if (window > 0)
+		{
+			float dx = std::fmod(std::abs(pt.x_angle - prior_x), 360.f);
+			dx = std::min(dx, 360.f - dx);
+			if (dx > window || std::abs(pt.y_angle - prior_y) > window) continue;
+		}
+		rows.push_back((int)i);
+	}
+	if (rows.empty())
+	{
+		return;
+	}
+
+	Mat query, thumb;
+	prepareQuery(image, query, thumb);
+	std::vector<float> scores;
+
+	//Shortlist with the thumbnails when there are more points than are worth verifying
+	int shortlist = std::max(k, (int)shortlist_size_);
+	if ((int)rows.size() > shortlist)
+	{
+		scoreRows(thumb_bank_, thumb_norms_, thumb, rows, scores);
+		keepBest(shortlist, rows, scores);
+	}
+
+	scoreRows(bank_, bank_norms_, query, rows, scores);
+	keepBest(k, rows, scores);
+
+	candidates.reserve(rows.size());
+	for (size_t i = 0; i < rows.size(); i++)
+	{
+		const RelocalizerPoint &pt = relocalization_points[rows[i]];
+		Candidate c = { pt.x_angle, pt.y_angle, pt.z_angle, scores[i] };
+		candidates.push_back(c);
+	}
 }
 
 void Relocalizer::GetRelocalizationInfo(std::vector<Mat>& images, std::vector<float>& x_rotations, std::vector<float>& y_rotations, std::vector<float>& z_rotations) const
 {
 	for (size_t i = 0; i < relocalization_points.size(); i++)
 	{
-		images.push_back(relocalization_points.at(i).image);
+		images.push_back(bank_.row((int)i).clone().reshape(1, reloc_image_height_));
 		x_rotations.push_back(relocalization_points.at(i).x_angle);
 		y_rotations.push_back(relocalization_points.at(i).y_angle);
 		z_rotations.push_back(relocalization_points.at(i).z_angle);
@@ -37,49 +155,96 @@ void Relocalizer::GetRelocalizationInfo(std::vector<Mat>& images, std::vector<fl
 
 void Relocalizer::AddRelocalizationPointUnmodified(Mat image, float x_rot, float y_rot, float z_rot)
 {
-	relocalization_points.push_back(RelocalizerPoint(image, x_rot, y_rot, z_rot));
+	//Saved images are already resized and blurred, only convert if they were stored differently
+	Mat img = image;
+	if (img.channels() > 1)
+	{
+		cvtColor(img, img, CV_BGR2GRAY);
+	}
+	if (img.depth() != CV_8U)
+	{
+		img.convertTo(img, CV_8U);
+	}
+	if (img.size() != Size(reloc_image_width_, reloc_image_height_))
+	{
+		resize(img, img, Size(reloc_image_width_, reloc_image_height_));
+	}
+	addToBank(img, x_rot, y_rot, z_rot);
+}
+
+int Relocalizer::GetSize() const
+{
+	return (int)relocalization_points.size();
+}
+
+Relocalizer Relocalizer::Clone() const
+{
+	Relocalizer copy(*this);
+	copy.bank_ = bank_.clone();
+	copy.thumb_bank_ = thumb_bank_.clone();
+	return copy;
 }
 
-Relocalizer::RelocalizerPoint Relocalizer::relocalize(Mat image, float &quality) const
+void Relocalizer::prepareQuery(Mat image, Mat &query, Mat &thumb) const
 {
 	//Blur and resize similar to when adding images
-	Mat resized_img, blurred_img;
+	Mat resized_img, blurred_img, thumb_img;
 	resize(image, resized_img, Size(reloc_image_width_, reloc_image_height_));
 	blurImage(resized_img, blurred_img);
+	CV_Assert(blurred_img.type() == CV_8UC1);
+	resize(blurred_img, thumb_img, Size(thumb_width_, thumb_height_), 0, 0, INTER_AREA);
+	query = blurred_img.isContinuous() ? blurred_img.reshape(1, 1) : blurred_img.clone().reshape(1, 1);
+	thumb = thumb_img.reshape(1, 1);
+}
 
-	//Match with all points and pick the best match
-	float best_quality = 100;
-	RelocalizerPoint best_point;
-	for (size_t i = 0; i < relocalization_points.size(); i++)
+void Relocalizer::scoreRows(const Mat &bank, const std::vector<double> &norms, const Mat &query, const std::vector<int> &rows, std::vector<float> &scores)
+{
+	//Equal-sized images give matchTemplate a single result, so CV_TM_SQDIFF_NORMED reduces to
+	//(|q|^2 + |b|^2 - 2 q.b) / (|q| |b|). Only the dot product depends on both images,
+	//and it is exact in integer arithmetic
+	const int len = query.cols;
+	const uchar *q = query.ptr<uchar>();
+	const int64 query_sum = dotRow(q, q, len);
+	const double query_norm = std::sqrt((double)query_sum);
+
+	scores.resize(rows.size());
+	for (size_t i = 0; i < rows.size(); i++)
 	{
-		float q = matchTemplates(blurred_img, relocalization_points.at(i).image);
-		if (q < best_quality)
-		{
-			best_quality = q;
-			best_point = relocalization_points.at(i);
-		}
+		int64 dot = dotRow(q, bank.ptr<uchar>(rows[i]), len);
+		double bank_norm = norms[rows[i]];
+		double ssd = (double)(query_sum - 2 * dot) + bank_norm * bank_norm;
+		double denom = query_norm * bank_norm;
+		//Same clamping as matchTemplate: a degenerate (flat black) image scores 1
+		scores[i] = (denom > 0 && ssd < denom) ? (float)std::max(ssd / denom, 0.0) : 1.f;
+	}
+}
+
+void Relocalizer::keepBest(int k, std::vector<int> &rows, std::vector<float> &scores)
+{
+	//Order only the k best, ties broken by insertion order like the old linear search
+	std::vector<int> order(rows.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = (int)i;
 	}
+	k = std::min(k, (int)order.size());
+	std::partial_sort(order.begin(), order.begin() + k, order.end(), [&](int a, int b)
+	{
+		return scores[a] < scores[b] || (scores[a] == scores[b] && rows[a] < rows[b]);
+	});
 
-	quality = best_quality;
-	return best_point;
+	std::vector<int> best_rows(k);
+	std::vector<float> best_scores(k);
+	for (int i = 0; i < k; i++)
+	{
+		best_rows[i] = rows[order[i]];
+		best_scores[i] = scores[order[i]];
+	}
+	rows.swap(best_rows);
+	scores.swap(best_scores);
 }
 
 void Relocalizer::blurImage(Mat image, Mat &result) const
 {
-	Mat blurred_image;
 	blur(image, result, Size(blur_size_, blur_size_));
 }
-
-float Relocalizer::matchTemplates(Mat image1, Mat image2) const
-{
-	float quality;
-	Mat result;
-
-	matchTemplate(image1, image2, result, CV_TM_SQDIFF_NORMED);
-	double min_val; double max_val; Point min_loc; Point max_loc;
-	Point match_loc;
-	minMaxLoc(result, &min_val, &max_val, &min_loc, &max_loc, Mat());
-	match_loc = min_loc;
-	quality = min_val;
-	return quality;
-}
\ No newline at end of file
@@ -1,6 +1,7 @@
 # pragma once
 #include <opencv/cv.h>
 #include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/imgcodecs/imgcodecs.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -12,17 +13,40 @@ using namespace cv;
 class Relocalizer
 {
 public:
+	//A single relocalization candidate returned by RelocalizeCandidates
+	struct Candidate
+	{
+		float x_rot;
+		float y_rot;
+		float z_rot;
+		//Normalized squared difference, 0 is a perfect match
+		float quality;
+	};
+
 	//Add a new relocalizer image
 	void AddRelocImage(Mat image, float x_rot, float y_rot, float z_rot);
 
 	//Run the relocalizer against image, and return the best candidate
 	void Relocalize(Mat image, float &x_rot, float &y_rot, float &z_rot, float &quality) const;
+
+	//Run the relocalizer only against points within window degrees of (prior_x, prior_y).
+	//A window of 0 or less searches all points
+	void Relocalize(Mat image, float prior_x, float prior_y, float window, float &x_rot, float &y_rot, float &z_rot, float &quality) const;
+
+	//Run the relocalizer against image, and return up to k best candidates, best first
+	void RelocalizeCandidates(Mat image, int k, std::vector<Candidate> &candidates) const;
 	
 	//Return info of all relocalization images and corresponding rotations
 	void GetRelocalizationInfo(std::vector<Mat> &images, std::vector<float> &x_rotations, std::vector<float> &y_rotations, std::vector<float> &z_rotations) const;
 	
 	//Add a relocalization point without modifying (resizing) the given image. Used with (deprecated) map save/load
 	void AddRelocalizationPointUnmodified(Mat image, float x_rot, float y_rot, float z_rot);
+
+	//Number of stored relocalization points
+	int GetSize() const;
+
+	//Deep copy that does not share the image banks with this relocalizer
+	Relocalizer Clone() const;
 private:
 
 	static const int reloc_image_width_ = 80;
@@ -30,18 +54,23 @@ private:
 
 	static const int blur_size_ = 5;
 
-	//Struct that represents a single relocalizer image and its data
+	//Thumbnails used to shortlist candidates before verifying them at full reloc size
+	static const int thumb_width_ = 20;
+	static const int thumb_height_ = 15;
+	//Number of thumbnail matches verified at full reloc size
+	static const int shortlist_size_ = 8;
+
+	//Rotation of a single relocalizer image. The image itself is stored in the bank
+	//at the same row index
 	struct RelocalizerPoint
 	{
 		RelocalizerPoint(){};
-		RelocalizerPoint(Mat img, float x, float y, float z) :
-		image(img),
+		RelocalizerPoint(float x, float y, float z) :
 		x_angle(x),
 		y_angle(y),
 		z_angle(z)
 		{};
 
-		Mat image;
 		float x_angle;
 		float y_angle;
 		float z_angle;
@@ -49,16 +78,39 @@ private:
 
 	//Add reloc point from the given image
 	void addRelocalizationPoint(Mat image, float x_rot, float y_rot, float z_rot);
+
+	//Append a reloc_image_width_ x reloc_image_height_ CV_8UC1 image to the bank
+	void addToBank(const Mat &image, float x_rot, float y_rot, float z_rot);
 	
 	//All stored relocalizer points
 	std::vector<RelocalizerPoint> relocalization_points;
+
+	//All relocalizer images packed into one CV_8UC1 matrix, one flattened image per row
+	Mat bank_;
+
+	//Euclidean norm of each bank row, precomputed for the normalized score
+	std::vector<double> bank_norms_;
+
+	//Thumbnails of the bank images, packed the same way
+	Mat thumb_bank_;
+	std::vector<double> thumb_norms_;
+
+	//Shortlist with the thumbnails and return up to k best verified candidates among the points
+	//within window degrees of the prior (all points if window <= 0)
+	void relocalize(Mat image, int k, float prior_x, float prior_y, float window, std::vector<Candidate> &candidates) const;
 	
-	//Find the best match for image and return that point
-	RelocalizerPoint relocalize(Mat image, float &quality) const;
+	//Resize and blur image into a flattened bank row, and its flattened thumbnail
+	void prepareQuery(Mat image, Mat &query, Mat &thumb) const;
+
+	//Append the flattened image and its norm to bank
+	static void appendRow(const Mat &image, Mat &bank, std::vector<double> &norms);
+
+	//Compute the normalized squared difference between query and the given bank rows
+	static void scoreRows(const Mat &bank, const std::vector<double> &norms, const Mat &query, const std::vector<int> &rows, std::vector<float> &scores);
+
+	//Keep only the k best scored rows in rows and scores, best first
+	static void keepBest(int k, std::vector<int> &rows, std::vector<float> &scores);
 	
 	//Blur the input image 
 	void blurImage(Mat image, Mat &result) const;
-	
-	//Match 2 images of same size and return quality
-	float matchTemplates(Mat image1, Mat image2) const;
-};
\ No newline at end of file
+};
@@ -0,0 +1,192 @@
+#include "SelfTest.h"
+#include "AllocationCounter.h"
+#include "ImageWarper.h"
+#include "OrderStatistics.h"
+#include "TemplateMatcher.h"
+#include <iostream>
+
+namespace SelfTest
+{
+	//Smooth test image, so that the differences caused by rounding the coordinates stay small
+	static Mat smoothImage(int width, int height)
+	{
+		Mat image(height, width, CV_8U);
+		for (int j = 0; j < height; j++)
+		{
+			uchar *row = image.ptr<uchar>(j);
+			for (int i = 0; i < width; i++)
+			{
+				row[i] = saturate_cast<uchar>(128 + 60 * sin(i / 13.f) + 60 * cos(j / 17.f));
+			}
+		}
+		return image;
+	}
+
+	static bool report(const char *name, bool passed, float value)
+	{
+		std::cout << name << ": " << value << (passed ? " passed" : " FAILED") << std::endl;
+		return passed;
+	}
+
+	int RunAll()
+	{
+		int failed = 0;
+		if (!SeparableWarp()) failed++;
+		if (!BatchedMatching()) failed++;
+		if (!SteadyStateAllocations()) failed++;
+		std::cout << failed << " checks failed" << std::endl;
+		return failed;
+	}
+
+	bool SeparableWarp()
+	{
+		//Mean absolute difference of the pixels, the warps only differ where the coordinates round differently
+		const float tolerance = 1.0f;
+		Mat image = smoothImage(640, 480);
+		ImageWarper warper(407, false);
+		float tilts[] = { -15, -5, 0, 5, 15 };
+		float pans[] = { 0, 37.3f, -90 };
+		float rolls[] = { -10, 0, 7 };
+		float worst = 0;
+		for (float tilt : tilts)
+		{
+			for (float pan : pans)
+			{
+				for (float roll : rolls)
+				{
+					worst = std::max(worst, warper.CompareSeparableWarp(image, tilt, pan, roll));
+				}
+			}
+		}
+		return report("separable warp, largest mean pixel difference", worst <= tolerance, worst);
+	}
+
+	bool BatchedMatching()
+	{
+		//Largest difference allowed for the rounding error of the DFT correlation of matchTemplate
+		const float tolerance = 1e-5f;
+		RNG rng(4);
+		Mat frame(240, 320, CV_8U);
+		rng.fill(frame, RNG::UNIFORM, 0, 256);
+		//A flat area and a repeating pattern give ties
+		frame(Rect(40, 40, 40, 30)).setTo(Scalar(90));
+		for (int j = 100; j < 140; j++)
+		{
+			for (int i = 100; i < 160; i++)
+			{
+				frame.at<uchar>(j, i) = (uchar)((i / 4 + j / 4) % 3 * 40);
+			}
+		}
+
+		TemplateMatcher matcher, single_matcher;
+		int identical = 0, total = 0, differing_jobs = 0;
+		float worst = 0;
+		int template_sizes[] = { 8, 16, 12 };
+		for (int template_size : template_sizes)
+		{
+			int search_size = template_size + 14;
+			std::vector<TemplateMatcher::MatchJob> jobs;
+			for (int k = 0; k < 41; k++)
+			{
+				//The template is a noisy copy of a part of the search area, or a flat or a textured area of the frame
+				TemplateMatcher::MatchJob job;
+				Point origin(rng.uniform(0, frame.cols - search_size), rng.uniform(0, frame.rows - search_size));
+				if (k % 4 == 1) origin = Point(rng.uniform(30, 45), rng.uniform(30, 40));
+				if (k % 4 == 2) origin = Point(rng.uniform(95, 120), rng.uniform(95, 110));
+				job.search_origin = origin;
+				Point inside(origin.x + rng.uniform(0, search_size - template_size + 1), origin.y + rng.uniform(0, search_size - template_size + 1));
+				Mat noise(template_size, template_size, CV_8U);
+				rng.fill(noise, RNG::UNIFORM, 0, 4);
+				add(frame(Rect(inside, Size(template_size, template_size))), noise, job.tmplt);
+				if (k % 10 == 9) job.tmplt = Scalar(0);
+				jobs.push_back(job);
+			}
+
+			std::vector<TemplateMatcher::MatchResult> results;
+			matcher.MatchBatch(frame, template_size, search_size, jobs, results, true);
+			for (size_t k = 0; k < jobs.size(); k++)
+			{
+				//The per-feature path of the tracker must give exactly the same location, value and sub-pixel peak
+				Mat search_area = frame(Rect(jobs[k].search_origin, Size(search_size, search_size)));
+				TemplateMatcher::MatchResult single = single_matcher.Match(search_area, jobs[k].tmplt, true);
+				const TemplateMatcher::MatchResult &result = results[k];
+				if (result.match_loc != single.match_loc || result.quality != single.quality || result.subpixel_loc != single.subpixel_loc)
+				{
+					differing_jobs++;
+				}
+
+				//The scores follow matchTemplate up to its rounding error
+				Mat reference, scores;
+				matchTemplate(search_area, jobs[k].tmplt, reference, CV_TM_SQDIFF_NORMED);
+				matcher.ScoreMap(search_area, jobs[k].tmplt, scores);
+				for (int j = 0; j < reference.rows; j++)
+				{
+					for (int i = 0; i < reference.cols; i++)
+					{
+						float difference = std::fabs(reference.at<float>(j, i) - scores.at<float>(j, i));
+						worst = std::max(worst, difference);
+						if (difference == 0) identical++;
+						total++;
+					}
+				}
+			}
+		}
+		std::cout << "batched matching: " << identical << " of " << total << " values identical to matchTemplate" << std::endl;
+		bool passed = report("batched matching, jobs differing from the per-feature path", differing_jobs == 0, (float)differing_jobs);
+		return report("exact scoring, largest value difference to matchTemplate", worst <= tolerance, worst) && passed;
+	}
+
+	bool SteadyStateAllocations()
+	{
+#ifdef PT_COUNT_ALLOCATIONS
+		RNG rng(7);
+		Mat frame(240, 320, CV_8U);
+		rng.fill(frame, RNG::UNIFORM, 0, 256);
+		std::vector<TemplateMatcher::MatchJob> jobs;
+		for (int k = 0; k < 40; k++)
+		{
+			TemplateMatcher::MatchJob job;
+			job.search_origin = Point(rng.uniform(0, frame.cols - 30), rng.uniform(0, frame.rows - 30));
+			job.tmplt = frame(Rect(job.search_origin + Point(4, 5), Size(16, 16))).clone();
+			jobs.push_back(job);
+		}
+		std::vector<float> x_moves, y_moves, filtered_x, filtered_y, scratch;
+		for (int k = 0; k < 40; k++)
+		{
+			x_moves.push_back(rng.uniform(-3.f, 3.f));
+			y_moves.push_back(rng.uniform(-3.f, 3.f));
+		}
+		ImageWarper warper(407, false);
+		warper.SetMapCache(true, 0.1f);
+		Mat color(480, 640, CV_8UC3);
+		rng.fill(color, RNG::UNIFORM, 0, 256);
+		Mat warped, mask;
+
+		//The first round grows the buffers and builds the warp maps, the second one is counted
+		TemplateMatcher matcher;
+		std::vector<TemplateMatcher::MatchResult> results;
+		OrderStatistics::MovementStatistics stats;
+		AllocationCounter::Tally matching, warping;
+		for (int round = 0; round < 2; round++)
+		{
+			matching.Reset();
+			warping.Reset();
+			{
+				AllocationCounter::Scope allocation_scope(matching);
+				matcher.MatchBatch(frame, 16, 30, jobs, results, true);
+				OrderStatistics::FilterMovements(x_moves, y_moves, 1.5f, filtered_x, filtered_y, scratch, stats);
+			}
+			{
+				AllocationCounter::Scope allocation_scope(warping);
+				warper.warpColorImageCylindrical(color, 3, 20, 1, warped, mask);
+			}
+		}
+		std::cout << "cached warp allocations" << (AllocationCounter::SeesMatAllocations() ? "" : " without Mat data")
+			<< ": " << warping.Count() << std::endl;
+		return report("steady state matching and filtering allocations", matching.Count() == 0, (float)matching.Count());
+#else
+		std::cout << "steady state allocations: skipped, compile with PT_COUNT_ALLOCATIONS" << std::endl;
+		return true;
+#endif
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+Checks of the optimized paths of the tracker against their reference implementations. 
+Run with the --selftest command line argument. Every check prints its result
+*/
+namespace SelfTest
+{
+	//Run all the checks and return the number of failed ones
+	int RunAll();
+
+	//The separable warp gives the same image as the full warp of the warper, over a range of poses
+	bool SeparableWarp();
+
+	/*
+	The batched matcher gives exactly the same locations, values and sub-pixel peaks as the per-feature path of the
+	tracker (TemplateMatcher::Match). The values of the exact scorer are also compared to matchTemplate with
+	CV_TM_SQDIFF_NORMED, which differs only when its correlation is not exact (its DFT path), and then only by its rounding error
+	*/
+	bool BatchedMatching();
+
+	/*
+	Once their buffers have grown, the batched matcher and the movement filtering do not allocate. The allocations 
+	of a cached warp are only printed, since remap allocates inside OpenCV. Passes without checking unless compiled 
+	with PT_COUNT_ALLOCATIONS
+	*/
+	bool SteadyStateAllocations();
+}
@@ -0,0 +1,115 @@
+#include "SimilarityEstimator.h"
+
+SimilarityEstimator::SimilarityEstimator(int iterations, float inlierThreshold)
+: iterations_(iterations), inlier_threshold_(inlierThreshold)
+{
+}
+
+bool SimilarityEstimator::Estimate(const std::vector<Point2f> &src, const std::vector<Point2f> &dst, Similarity &result)
+{
+	int n = (int)src.size();
+	inlier_count_ = 0;
+	if (n < 2) return false;
+
+	//Fixed seed, so the same correspondences always give the same result
+	RNG rng(0x5eed);
+	int best_count = 0;
+	Similarity best = { 0, 1, Point2f(0, 0) };
+	sample_src_.resize(2);
+	sample_dst_.resize(2);
+	for (int i = 0; i < iterations_; i++)
+	{
+		//Two correspondences define a similarity. Points too close to each other give an unstable angle
+		int a = rng.uniform(0, n);
+		int b = rng.uniform(0, n - 1);
+		if (b >= a) b++;
+		Point2f d = src[a] - src[b];
+		if (d.x * d.x + d.y * d.y < 4) continue;
+
+		sample_src_[0] = src[a]; sample_src_[1] = src[b];
+		sample_dst_[0] = dst[a]; sample_dst_[1] = dst[b];
+		Similarity hypothesis;
+		if (!Fit(sample_src_, sample_dst_, nullptr, hypothesis)) continue;
+		int count = findInliers(src, dst, hypothesis, inliers_);
+		if (count > best_count)
+		{
+			best_count = count;
+			best = hypothesis;
+			best_inliers_.swap(inliers_);
+		}
+	}
+	if (best_count < 2) return false;
+
+	//Refine on the inliers, and once more on the inliers of the refined similarity
+	for (int i = 0; i < 2; i++)
+	{
+		Similarity refined;
+		if (!Fit(src, dst, &best_inliers_, refined)) break;
+		int count = findInliers(src, dst, refined, inliers_);
+		if (count < best_count) break;
+		best = refined;
+		best_count = count;
+		best_inliers_.swap(inliers_);
+	}
+	result = best;
+	inlier_count_ = best_count;
+	return true;
+}
+
+int SimilarityEstimator::GetInlierCount() const
+{
+	return inlier_count_;
+}
+
+bool SimilarityEstimator::Fit(const std::vector<Point2f> &src, const std::vector<Point2f> &dst, const std::vector<uchar> *mask, Similarity &result)
+{
+	//Centroids of the used points
+	double src_x = 0, src_y = 0, dst_x = 0, dst_y = 0;
+	int count = 0;
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		if (mask && !(*mask)[i]) continue;
+		src_x += src[i].x; src_y += src[i].y;
+		dst_x += dst[i].x; dst_y += dst[i].y;
+		count++;
+	}
+	if (count < 2) return false;
+	src_x /= count; src_y /= count;
+	dst_x /= count; dst_y /= count;
+
+	//With centered points the least squares rotation and scale are (a, b) = sum of (s.d, s x d) scaled by the spread of s
+	double a = 0, b = 0, spread = 0;
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		if (mask && !(*mask)[i]) continue;
+		double sx = src[i].x - src_x, sy = src[i].y - src_y;
+		double dx = dst[i].x - dst_x, dy = dst[i].y - dst_y;
+		a += sx * dx + sy * dy;
+		b += sx * dy - sy * dx;
+		spread += sx * sx + sy * sy;
+	}
+	if (spread < 1e-6) return false;
+
+	double c = a / spread, s = b / spread;
+	result.angle = (float)std::atan2(b, a);
+	result.scale = (float)std::sqrt(c * c + s * s);
+	result.translation = Point2f((float)(dst_x - (c * src_x - s * src_y)), (float)(dst_y - (s * src_x + c * src_y)));
+	return true;
+}
+
+int SimilarityEstimator::findInliers(const std::vector<Point2f> &src, const std::vector<Point2f> &dst, const Similarity &similarity, std::vector<uchar> &mask) const
+{
+	float c = similarity.scale * std::cos(similarity.angle);
+	float s = similarity.scale * std::sin(similarity.angle);
+	float threshold = inlier_threshold_ * inlier_threshold_;
+	mask.resize(src.size());
+	int count = 0;
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		float ex = c * src[i].x - s * src[i].y + similarity.translation.x - dst[i].x;
+		float ey = s * src[i].x + c * src[i].y + similarity.translation.y - dst[i].y;
+		mask[i] = ex * ex + ey * ey <= threshold;
+		count += mask[i];
+	}
+	return count;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+using namespace cv;
+
+/*
+Robust 2D similarity (rotation, uniform scale and translation) between point correspondences.
+Replaces estimateRigidTransform(src, dst, false): hypotheses are solved in closed form from point pairs
+picked with a fixed seed, so the result is repeatable, and the best one is refined by least squares
+on its inliers. The buffers are reused between calls
+*/
+class SimilarityEstimator
+{
+public:
+	//dst = scale * R(angle) * src + translation, angle in radians
+	struct Similarity
+	{
+		float angle;
+		float scale;
+		Point2f translation;
+	};
+
+	//iterations is the number of hypotheses, inlierThreshold the largest residual of an inlier in pixels
+	SimilarityEstimator(int iterations = 32, float inlierThreshold = 2);
+
+	//Estimate the similarity. Returns false if there are less than two distinct points or no consensus
+	bool Estimate(const std::vector<Point2f> &src, const std::vector<Point2f> &dst, Similarity &result);
+
+	//Number of inliers of the last successful estimate
+	int GetInlierCount() const;
+
+	//Least squares similarity of the correspondences whose mask value is nonzero, all of them if mask is null
+	static bool Fit(const std::vector<Point2f> &src, const std::vector<Point2f> &dst, const std::vector<uchar> *mask, Similarity &result);
+
+private:
+	int iterations_;
+	float inlier_threshold_;
+	int inlier_count_ = 0;
+	std::vector<uchar> inliers_;
+	std::vector<uchar> best_inliers_;
+	std::vector<Point2f> sample_src_;
+	std::vector<Point2f> sample_dst_;
+
+	//Mark the inliers of the similarity in mask and return their count
+	int findInliers(const std::vector<Point2f> &src, const std::vector<Point2f> &dst, const Similarity &similarity, std::vector<uchar> &mask) const;
+};
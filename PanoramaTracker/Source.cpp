@@ -1,9 +1,13 @@
 #include "PanoramaTracker.h"
+#include "SelfTest.h"
+#include "Benchmark.h"
 #include <chrono>
 #include <opencv2/highgui.hpp>
 #define MAIN_WINDOW "Camera"
 #define SETTINGS_WINDOW "Settings"
 //#define USE_WEBCAM
+//Warp the next frame on a background thread while the current one is tracked
+//#define USE_PIPELINE
 
 bool isVideoPlaying = false;
 
@@ -23,9 +27,20 @@ void mouseCallback(int event, int x, int y, int flags, void* point)
 
 /*
 Sample usage of Panorama Tracker native
+Run with --selftest to check the optimized paths against their reference implementations,
+or with --benchmark [video] to compare the tracking modes on a video
 */
-int main()
+int main(int argc, char **argv)
 {
+	if (argc > 1 && std::string(argv[1]) == "--selftest")
+	{
+		return SelfTest::RunAll() == 0 ? 0 : 1;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark")
+	{
+		return Benchmark::RunAll(argc > 2 ? argv[2] : "Videos/rot/rot2.mp4") ? 0 : 1;
+	}
+
 	//Create the windows for settings and image
 	namedWindow(MAIN_WINDOW);
 	namedWindow(SETTINGS_WINDOW);
@@ -125,7 +140,11 @@ vid_end:
 				}
 
 				//Actual tracking function call
+#ifdef USE_PIPELINE
+				pt.CalculateOrientationPipelined(frame);
+#else
 				pt.CalculateOrientation(frame);
+#endif
 			}
 		}
 		//Restart video playback
@@ -170,7 +189,7 @@ vid_end:
 			pt.debug_match_templates = !pt.debug_match_templates;
 			break;
 		//m to change the viewed map size, if pyramidical mode is on
-		//Pyramicidal mode is currently deprecated
+		//Pyramicidal mode is currently deprecated, unless PT_COARSE_TO_FINE is used
 		case 109:
 			switch (mapSize)
 			{
@@ -191,6 +210,14 @@ vid_end:
 			settings.Set(PT_MAX_KEYPOINTS_PER_CELL, max_keypoints_per_cell);
 			pt = PanoramaTracker(settings);
 			break;
+		//w to compare the separable warp against the full warp, the last error is printed when the check is turned off
+		case 119:
+			if (pt.debug_warp_check)
+			{
+				std::cout << pt.GetDebugData() << std::endl;
+			}
+			pt.debug_warp_check = !pt.debug_warp_check;
+			break;
 		//x to show keypoints
 		case 120:
 			show_keypoints = !show_keypoints;
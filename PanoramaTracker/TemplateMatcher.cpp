@@ -0,0 +1,327 @@
+#include "TemplateMatcher.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void TemplateMatcher::MatchBatch(const Mat &frame, int templateSize, int searchSize,
+	const std::vector<MatchJob> &jobs, std::vector<MatchResult> &results, bool subpixel)
+{
+	results.resize(jobs.size());
+	int positions = searchSize - templateSize + 1;
+	if (positions < 1)
+	{
+		//No position to match, every job fails with the worst value
+		MatchResult none;
+		none.match_loc = Point(0, 0);
+		none.subpixel_loc = Point2f(0, 0);
+		none.quality = 1;
+		std::fill(results.begin(), results.end(), none);
+		return;
+	}
+
+	int area = positions * positions;
+	correlations_.resize(2 * area);
+	scores_.resize(area);
+	int *correlations[2] = { &correlations_[0], &correlations_[area] };
+	size_t i = 0;
+#if defined(__AVX2__)
+	//Two 8 pixel wide templates fill a 256 bit register, so the jobs are correlated in pairs
+	if (templateSize == 8)
+	{
+		for (; i + 1 < jobs.size(); i += 2)
+		{
+			const MatchJob &a = jobs[i], &b = jobs[i + 1];
+			const uchar *image_a = frame.ptr<uchar>(a.search_origin.y) + a.search_origin.x;
+			const uchar *image_b = frame.ptr<uchar>(b.search_origin.y) + b.search_origin.x;
+			correlatePair8(a.tmplt.ptr<uchar>(0), a.tmplt.step, image_a, b.tmplt.ptr<uchar>(0), b.tmplt.step, image_b,
+				frame.step, positions, correlations[0], correlations[1]);
+			scorePositions(a.tmplt.ptr<uchar>(0), a.tmplt.step, image_a, frame.step, templateSize, positions, positions, correlations[0], &scores_[0]);
+			results[i] = findBest(&scores_[0], positions, positions, subpixel);
+			scorePositions(b.tmplt.ptr<uchar>(0), b.tmplt.step, image_b, frame.step, templateSize, positions, positions, correlations[1], &scores_[0]);
+			results[i + 1] = findBest(&scores_[0], positions, positions, subpixel);
+		}
+	}
+#endif
+	for (; i < jobs.size(); i++)
+	{
+		const MatchJob &job = jobs[i];
+		const uchar *image = frame.ptr<uchar>(job.search_origin.y) + job.search_origin.x;
+		correlateAny(job.tmplt.ptr<uchar>(0), job.tmplt.step, image, frame.step, templateSize, positions, positions, correlations[0]);
+		scorePositions(job.tmplt.ptr<uchar>(0), job.tmplt.step, image, frame.step, templateSize, positions, positions, correlations[0], &scores_[0]);
+		results[i] = findBest(&scores_[0], positions, positions, subpixel);
+	}
+}
+
+void TemplateMatcher::ScoreMap(const Mat &image, const Mat &tmplt, Mat &result)
+{
+	Size positions = scoreAll(image, tmplt);
+	result.create(positions.height, positions.width, CV_32F);
+	for (int y = 0; y < positions.height; y++)
+	{
+		std::copy(&scores_[y * positions.width], &scores_[y * positions.width] + positions.width, result.ptr<float>(y));
+	}
+}
+
+TemplateMatcher::MatchResult TemplateMatcher::Match(const Mat &image, const Mat &tmplt, bool subpixel)
+{
+	Size positions = scoreAll(image, tmplt);
+	return findBest(&scores_[0], positions.width, positions.height, subpixel);
+}
+
+Size TemplateMatcher::scoreAll(const Mat &image, const Mat &tmplt)
+{
+	CV_Assert(image.type() == CV_8UC1 && tmplt.type() == CV_8UC1 && tmplt.rows == tmplt.cols);
+	int positions_x = image.cols - tmplt.cols + 1, positions_y = image.rows - tmplt.rows + 1;
+	CV_Assert(positions_x > 0 && positions_y > 0);
+	correlations_.resize(positions_x * positions_y);
+	correlateAny(tmplt.ptr<uchar>(0), tmplt.step, image.ptr<uchar>(0), image.step, tmplt.cols, positions_x, positions_y, &correlations_[0]);
+	scores_.resize(positions_x * positions_y);
+	scorePositions(tmplt.ptr<uchar>(0), tmplt.step, image.ptr<uchar>(0), image.step, tmplt.cols, positions_x, positions_y, &correlations_[0], &scores_[0]);
+	return Size(positions_x, positions_y);
+}
+
+void TemplateMatcher::correlateAny(const uchar *tmplt, size_t tmpltStep, const uchar *image, size_t imageStep,
+	int templateSize, int positionsX, int positionsY, int *correlations)
+{
+	//Dispatch once per template, so that the common template sizes get unrolled kernels
+	switch (templateSize)
+	{
+	case 8:
+		correlate<8>(tmplt, tmpltStep, image, imageStep, templateSize, positionsX, positionsY, correlations);
+		break;
+	case 16:
+		correlate<16>(tmplt, tmpltStep, image, imageStep, templateSize, positionsX, positionsY, correlations);
+		break;
+	default:
+		correlate<0>(tmplt, tmpltStep, image, imageStep, templateSize, positionsX, positionsY, correlations);
+		break;
+	}
+}
+
+template<int TemplateSize>
+void TemplateMatcher::correlate(const uchar *tmplt, size_t tmpltStep, const uchar *image, size_t imageStep,
+	int templateSize, int positionsX, int positionsY, int *correlations)
+{
+	if (TemplateSize > 0) templateSize = TemplateSize;
+#if defined(__AVX2__)
+	//A 16 pixel row widened to 16 bits fills a 256 bit register. The template rows are widened once for all positions
+	if (templateSize == 16)
+	{
+		__m256i t_rows[16];
+		for (int y = 0; y < 16; y++)
+		{
+			t_rows[y] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(tmplt + y * tmpltStep)));
+		}
+		for (int dy = 0; dy < positionsY; dy++)
+		{
+			for (int dx = 0; dx < positionsX; dx++)
+			{
+				const uchar *window = image + dy * imageStep + dx;
+				__m256i sum = _mm256_setzero_si256();
+				for (int y = 0; y < 16; y++)
+				{
+					__m256i i_row = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(window + y * imageStep)));
+					sum = _mm256_add_epi32(sum, _mm256_madd_epi16(i_row, t_rows[y]));
+				}
+				__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+				half = _mm_hadd_epi32(half, half);
+				half = _mm_hadd_epi32(half, half);
+				correlations[dy * positionsX + dx] = _mm_cvtsi128_si32(half);
+			}
+		}
+		return;
+	}
+#endif
+	int x_simd = 0;
+#if CV_SIMD128
+	x_simd = templateSize - templateSize % 8;
+#endif
+	for (int dy = 0; dy < positionsY; dy++)
+	{
+		for (int dx = 0; dx < positionsX; dx++)
+		{
+			const uchar *window = image + dy * imageStep + dx;
+			int sum = 0;
+#if CV_SIMD128
+			//8 pixels at a time: widen to 16 bits and accumulate the products with multiply-add
+			if (x_simd > 0)
+			{
+				v_int32x4 v_sum = v_setzero_s32();
+				for (int y = 0; y < templateSize; y++)
+				{
+					const uchar *t_row = tmplt + y * tmpltStep;
+					const uchar *i_row = window + y * imageStep;
+					for (int x = 0; x < x_simd; x += 8)
+					{
+						v_sum += v_dotprod(v_reinterpret_as_s16(v_load_expand(i_row + x)), v_reinterpret_as_s16(v_load_expand(t_row + x)));
+					}
+				}
+				sum = v_reduce_sum(v_sum);
+			}
+#endif
+			//Remaining columns, or the whole template without SIMD support
+			for (int y = 0; y < templateSize && x_simd < templateSize; y++)
+			{
+				const uchar *t_row = tmplt + y * tmpltStep;
+				const uchar *i_row = window + y * imageStep;
+				for (int x = x_simd; x < templateSize; x++)
+				{
+					sum += i_row[x] * t_row[x];
+				}
+			}
+			correlations[dy * positionsX + dx] = sum;
+		}
+	}
+}
+
+void TemplateMatcher::correlatePair8(const uchar *tmpltA, size_t tmpltStepA, const uchar *imageA,
+	const uchar *tmpltB, size_t tmpltStepB, const uchar *imageB, size_t imageStep, int positions, int *correlationsA, int *correlationsB)
+{
+#if defined(__AVX2__)
+	//Job A is in the lower and job B in the upper half of every register
+	__m256i t_rows[8];
+	for (int y = 0; y < 8; y++)
+	{
+		__m128i rows = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(tmpltA + y * tmpltStepA)),
+			_mm_loadl_epi64((const __m128i*)(tmpltB + y * tmpltStepB)));
+		t_rows[y] = _mm256_cvtepu8_epi16(rows);
+	}
+	for (int dy = 0; dy < positions; dy++)
+	{
+		for (int dx = 0; dx < positions; dx++)
+		{
+			size_t offset = dy * imageStep + dx;
+			__m256i sum = _mm256_setzero_si256();
+			for (int y = 0; y < 8; y++)
+			{
+				__m128i rows = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(imageA + offset + y * imageStep)),
+					_mm_loadl_epi64((const __m128i*)(imageB + offset + y * imageStep)));
+				sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_cvtepu8_epi16(rows), t_rows[y]));
+			}
+			//Sum each half: the first element is the sum of A and the second the sum of B
+			__m128i halves = _mm_hadd_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+			halves = _mm_hadd_epi32(halves, halves);
+			correlationsA[dy * positions + dx] = _mm_cvtsi128_si32(halves);
+			correlationsB[dy * positions + dx] = _mm_extract_epi32(halves, 1);
+		}
+	}
+#else
+	correlate<8>(tmpltA, tmpltStepA, imageA, imageStep, 8, positions, positions, correlationsA);
+	correlate<8>(tmpltB, tmpltStepB, imageB, imageStep, 8, positions, positions, correlationsB);
+#endif
+}
+
+void TemplateMatcher::scorePositions(const uchar *tmplt, size_t tmpltStep, const uchar *image, size_t imageStep,
+	int templateSize, int positionsX, int positionsY, const int *correlations, float *scores)
+{
+	//The template terms as matchTemplate derives them from meanStdDev, in the same order of operations
+	int sum = 0, square_sum = 0;
+	for (int y = 0; y < templateSize; y++)
+	{
+		const uchar *row = tmplt + y * tmpltStep;
+		for (int x = 0; x < templateSize; x++)
+		{
+			sum += row[x];
+			square_sum += row[x] * row[x];
+		}
+	}
+	double inv_area = 1. / ((double)templateSize * templateSize);
+	double mean = sum * inv_area;
+	double deviation = std::sqrt(std::max(square_sum * inv_area - mean * mean, 0.));
+	double template_sum2 = deviation * deviation + mean * mean;
+	double template_norm = std::sqrt(template_sum2);
+	template_norm /= std::sqrt(inv_area);
+	template_sum2 /= inv_area;
+
+	//Integral of the squared image values, the window sums are exact like the double integral of matchTemplate
+	int width = positionsX + templateSize - 1, height = positionsY + templateSize - 1;
+	int stride = width + 1;
+	window_sums_.resize(stride * (height + 1));
+	int *integral = &window_sums_[0];
+	std::fill(integral, integral + stride, 0);
+	for (int y = 0; y < height; y++)
+	{
+		const uchar *row = image + y * imageStep;
+		int *previous = integral + y * stride, *current = previous + stride;
+		int row_sum = 0;
+		current[0] = 0;
+		for (int x = 0; x < width; x++)
+		{
+			row_sum += row[x] * row[x];
+			current[x + 1] = previous[x + 1] + row_sum;
+		}
+	}
+
+	for (int dy = 0; dy < positionsY; dy++)
+	{
+		const int *top = integral + dy * stride, *bottom = integral + (dy + templateSize) * stride;
+		for (int dx = 0; dx < positionsX; dx++)
+		{
+			double window_sum = top[dx] - top[dx + templateSize] - bottom[dx] + bottom[dx + templateSize];
+			//matchTemplate stores the correlation in its float result before normalizing
+			double num = (float)correlations[dy * positionsX + dx];
+			num = window_sum - 2 * num + template_sum2;
+			num = std::max(num, 0.);
+			double t = std::sqrt(std::max(window_sum, 0.)) * template_norm;
+			if (std::fabs(num) < t)
+				num /= t;
+			else if (std::fabs(num) < t * 1.125)
+				num = num > 0 ? 1 : -1;
+			else
+				num = 1;
+			scores[dy * positionsX + dx] = (float)num;
+		}
+	}
+}
+
+TemplateMatcher::MatchResult TemplateMatcher::findBest(const float *scores, int positionsX, int positionsY, bool subpixel)
+{
+	//Scan the positions in the same order as minMaxLoc, so that ties resolve to the same location
+	MatchResult result;
+	result.match_loc = Point(0, 0);
+	result.quality = scores[0];
+	for (int dy = 0; dy < positionsY; dy++)
+	{
+		for (int dx = 0; dx < positionsX; dx++)
+		{
+			if (scores[dy * positionsX + dx] < result.quality)
+			{
+				result.quality = scores[dy * positionsX + dx];
+				result.match_loc = Point(dx, dy);
+			}
+		}
+	}
+	result.subpixel_loc = subpixel ? refinePeak(scores, positionsX, positionsY, result.match_loc)
+		: Point2f(result.match_loc.x, result.match_loc.y);
+	return result;
+}
+
+Point2f TemplateMatcher::RefinePeak(const Mat &result, Point loc)
+{
+	CV_Assert(result.type() == CV_32FC1 && result.isContinuous());
+	return refinePeak(result.ptr<float>(0), result.cols, result.rows, loc);
+}
+
+Point2f TemplateMatcher::refinePeak(const float *values, int cols, int rows, Point loc)
+{
+	Point2f refined(loc.x, loc.y);
+	const float *row = values + loc.y * cols;
+	if (loc.x > 0 && loc.x < cols - 1)
+	{
+		refined.x += PeakOffset(row[loc.x - 1], row[loc.x], row[loc.x + 1]);
+	}
+	if (loc.y > 0 && loc.y < rows - 1)
+	{
+		refined.y += PeakOffset(row[loc.x - cols], row[loc.x], row[loc.x + cols]);
+	}
+	return refined;
+}
+
+float TemplateMatcher::PeakOffset(float previous, float peak, float next)
+{
+	//The vertex of the parabola is the same for minimums and maximums. A flat surface gives no refinement
+	float curvature = previous - 2 * peak + next;
+	if (curvature == 0) return 0;
+	float offset = 0.5f * (previous - next) / curvature;
+	return std::max(-0.5f, std::min(0.5f, offset));
+}
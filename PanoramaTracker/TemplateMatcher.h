@@ -0,0 +1,91 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <vector>
+
+using namespace cv;
+
+/*
+Matches a batch of small templates against their search areas with CV_TM_SQDIFF_NORMED.
+Replaces a matchTemplate and minMaxLoc call per feature. The correlation and the sums of squares are
+calculated exactly with integers, and the normalization repeats the double precision arithmetic of
+matchTemplate, so the values are the same as matchTemplate gives whenever its correlation is exact.
+With AVX2 the 8 pixel wide templates are correlated two jobs at a time, and the 16 pixel wide ones a
+row at a time. Other widths that are multiples of 8 use the 128 bit kernels (SSE2 or NEON)
+*/
+class TemplateMatcher
+{
+public:
+	//A single template search. The search area is read from the frame
+	struct MatchJob
+	{
+		Mat tmplt;				//The template, a part of the map
+		Point search_origin;	//Top left corner of the search area in the frame
+	};
+
+	//The best location (top left corner inside the search area) and its CV_TM_SQDIFF_NORMED value.
+	//subpixel_loc is match_loc refined with a parabola fitted to the neighbouring values, or match_loc without refinement
+	struct MatchResult
+	{
+		Point match_loc;
+		Point2f subpixel_loc;
+		float quality;
+	};
+
+	/*
+	Match all jobs. templateSize and searchSize are the side lengths of the square template and search area.
+	All search areas are expected to be inside the frame. The neighbours of the best location are only
+	used when subpixel refinement is requested
+	*/
+	void MatchBatch(const Mat &frame, int templateSize, int searchSize,
+		const std::vector<MatchJob> &jobs, std::vector<MatchResult> &results, bool subpixel);
+
+	//CV_TM_SQDIFF_NORMED value of every position of the square CV_8UC1 tmplt in image, as matchTemplate gives them
+	void ScoreMap(const Mat &image, const Mat &tmplt, Mat &result);
+
+	/*
+	Match a single template against the whole image. The scores and the best location are computed by the same code as
+	in MatchBatch, so the result is identical to the one of the same job in a batch
+	*/
+	MatchResult Match(const Mat &image, const Mat &tmplt, bool subpixel);
+
+	//Refine the extremum loc of a CV_32FC1 matchTemplate result to sub-pixel accuracy
+	static Point2f RefinePeak(const Mat &result, Point loc);
+
+	//Offset of the vertex of the parabola through the values at -1, 0 and 1, limited to [-0.5, 0.5]
+	static float PeakOffset(float previous, float peak, float next);
+
+private:
+	//Buffers of the batch, kept between the frames so that matching does not allocate
+	std::vector<int> correlations_;
+	std::vector<int> window_sums_;
+	std::vector<float> scores_;
+
+	//Score every position of tmplt in image into scores_, and return the number of positions in x and y
+	Size scoreAll(const Mat &image, const Mat &tmplt);
+
+	//Correlation of the template with every position of the search area, with the template width known at compile time when TemplateSize > 0
+	template<int TemplateSize>
+	static void correlate(const uchar *tmplt, size_t tmpltStep, const uchar *image, size_t imageStep,
+		int templateSize, int positionsX, int positionsY, int *correlations);
+
+	//Correlate two jobs of 8x8 templates at the same time, one in each half of the AVX2 registers
+	static void correlatePair8(const uchar *tmpltA, size_t tmpltStepA, const uchar *imageA,
+		const uchar *tmpltB, size_t tmpltStepB, const uchar *imageB, size_t imageStep, int positions, int *correlationsA, int *correlationsB);
+
+	//Correlate the template with the frame area starting at image, choosing the kernel by templateSize
+	static void correlateAny(const uchar *tmplt, size_t tmpltStep, const uchar *image, size_t imageStep,
+		int templateSize, int positionsX, int positionsY, int *correlations);
+
+	//CV_TM_SQDIFF_NORMED values of all positions from their correlations, computed like matchTemplate does
+	void scorePositions(const uchar *tmplt, size_t tmpltStep, const uchar *image, size_t imageStep,
+		int templateSize, int positionsX, int positionsY, const int *correlations, float *scores);
+
+	//The best position of the scores, resolving ties to the first position like minMaxLoc, optionally refined to sub-pixel accuracy
+	static MatchResult findBest(const float *scores, int positionsX, int positionsY, bool subpixel);
+
+	//Sub-pixel refinement of loc in a row major table of values
+	static Point2f refinePeak(const float *values, int cols, int rows, Point loc);
+};
@@ -0,0 +1,201 @@
+#include "TiledImage.h"
+
+TiledImage::TiledImage()
+: image_size_(0, 0),
+tile_size_(0, 0),
+type_(CV_8U),
+tiles_x_(0),
+tiles_y_(0)
+{
+}
+
+TiledImage::TiledImage(Size imageSize, Size tileSize, int type)
+: image_size_(imageSize),
+tile_size_(tileSize),
+type_(type)
+{
+	tiles_x_ = (imageSize.width + tileSize.width - 1) / tileSize.width;
+	tiles_y_ = (imageSize.height + tileSize.height - 1) / tileSize.height;
+	tiles_.resize(tiles_x_ * tiles_y_);
+}
+
+Size TiledImage::GetSize() const
+{
+	return image_size_;
+}
+
+Size TiledImage::GetTileSize() const
+{
+	return tile_size_;
+}
+
+int TiledImage::GetType() const
+{
+	return type_;
+}
+
+int TiledImage::TilesX() const
+{
+	return tiles_x_;
+}
+
+int TiledImage::TilesY() const
+{
+	return tiles_y_;
+}
+
+Rect TiledImage::GetTileRect(int tx, int ty) const
+{
+	Rect tile(tx * tile_size_.width, ty * tile_size_.height, tile_size_.width, tile_size_.height);
+	return tile & Rect(0, 0, image_size_.width, image_size_.height);
+}
+
+bool TiledImage::IsAllocated(int tx, int ty) const
+{
+	return !tiles_[ty * tiles_x_ + tx].empty();
+}
+
+Mat TiledImage::GetTile(int tx, int ty) const
+{
+	if (IsAllocated(tx, ty))
+	{
+		return tiles_[ty * tiles_x_ + tx];
+	}
+	return Mat::zeros(GetTileRect(tx, ty).size(), type_);
+}
+
+Mat TiledImage::GetTileForWrite(int tx, int ty)
+{
+	Mat &tile = tiles_[ty * tiles_x_ + tx];
+	if (tile.empty())
+	{
+		tile = Mat::zeros(GetTileRect(tx, ty).size(), type_);
+	}
+	else if (tile.u && tile.u->refcount > 1)
+	{
+		//Another copy of the image, or a region taken from it, still uses the tile
+		tile = tile.clone();
+	}
+	return tile;
+}
+
+void TiledImage::tileRange(const Rect &area, int &txBegin, int &tyBegin, int &txEnd, int &tyEnd) const
+{
+	Rect clipped = area & Rect(0, 0, image_size_.width, image_size_.height);
+	if (clipped.area() == 0)
+	{
+		txBegin = tyBegin = txEnd = tyEnd = 0;
+		return;
+	}
+	txBegin = clipped.x / tile_size_.width;
+	tyBegin = clipped.y / tile_size_.height;
+	txEnd = (clipped.x + clipped.width - 1) / tile_size_.width + 1;
+	tyEnd = (clipped.y + clipped.height - 1) / tile_size_.height + 1;
+}
+
+Mat TiledImage::GetRegion(const Rect &area) const
+{
+	int tx_begin, ty_begin, tx_end, ty_end;
+	tileRange(area, tx_begin, ty_begin, tx_end, ty_end);
+
+	//Area inside a single allocated tile can be returned without copying
+	if (tx_end - tx_begin == 1 && ty_end - ty_begin == 1 && IsAllocated(tx_begin, ty_begin))
+	{
+		Rect tile_rect = GetTileRect(tx_begin, ty_begin);
+		if ((area & tile_rect) == area)
+		{
+			return tiles_[ty_begin * tiles_x_ + tx_begin](area - tile_rect.tl());
+		}
+	}
+
+	//Otherwise copy the parts of all tiles touching the area
+	Mat region = Mat::zeros(area.size(), type_);
+	for (int ty = ty_begin; ty < ty_end; ty++)
+	{
+		for (int tx = tx_begin; tx < tx_end; tx++)
+		{
+			if (!IsAllocated(tx, ty)) continue;
+			Rect tile_rect = GetTileRect(tx, ty);
+			Rect common = area & tile_rect;
+			tiles_[ty * tiles_x_ + tx](common - tile_rect.tl()).copyTo(region(common - area.tl()));
+		}
+	}
+	return region;
+}
+
+void TiledImage::SetRegion(const Mat &image, Point origin, const Mat &mask)
+{
+	Rect area(origin, image.size());
+	int tx_begin, ty_begin, tx_end, ty_end;
+	tileRange(area, tx_begin, ty_begin, tx_end, ty_end);
+	for (int ty = ty_begin; ty < ty_end; ty++)
+	{
+		for (int tx = tx_begin; tx < tx_end; tx++)
+		{
+			Rect tile_rect = GetTileRect(tx, ty);
+			Rect common = area & tile_rect;
+			Rect in_image = common - area.tl();
+			if (mask.empty())
+			{
+				//Black pixels don't need to be written to unallocated tiles
+				if (!IsAllocated(tx, ty) && countNonZero(image(in_image)) == 0) continue;
+				image(in_image).copyTo(GetTileForWrite(tx, ty)(common - tile_rect.tl()));
+			}
+			else
+			{
+				if (countNonZero(mask(in_image)) == 0) continue;
+				image(in_image).copyTo(GetTileForWrite(tx, ty)(common - tile_rect.tl()), mask(in_image));
+			}
+		}
+	}
+}
+
+void TiledImage::SetRow(const uchar *pixels, Point origin, int length)
+{
+	int ty = origin.y / tile_size_.height;
+	for (int x = origin.x; x < origin.x + length;)
+	{
+		//Split the row at the tile borders
+		int tx = x / tile_size_.width;
+		Rect tile_rect = GetTileRect(tx, ty);
+		int end = std::min(origin.x + length, tile_rect.x + tile_rect.width);
+		Mat tile = GetTileForWrite(tx, ty);
+		size_t elem_size = tile.elemSize();
+		std::memcpy(tile.ptr(origin.y - tile_rect.y) + (x - tile_rect.x) * elem_size,
+			pixels + (x - origin.x) * elem_size, (end - x) * elem_size);
+		x = end;
+	}
+}
+
+void TiledImage::SetTo(const Rect &area, uchar value)
+{
+	int tx_begin, ty_begin, tx_end, ty_end;
+	tileRange(area, tx_begin, ty_begin, tx_end, ty_end);
+	for (int ty = ty_begin; ty < ty_end; ty++)
+	{
+		for (int tx = tx_begin; tx < tx_end; tx++)
+		{
+			if (value == 0 && !IsAllocated(tx, ty)) continue;
+			Rect tile_rect = GetTileRect(tx, ty);
+			GetTileForWrite(tx, ty)((area & tile_rect) - tile_rect.tl()).setTo(Scalar(value));
+		}
+	}
+}
+
+Mat TiledImage::ToMat() const
+{
+	return GetRegion(Rect(0, 0, image_size_.width, image_size_.height));
+}
+
+size_t TiledImage::GetMemoryFootprint() const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < tiles_.size(); i++)
+	{
+		if (!tiles_[i].empty())
+		{
+			bytes += tiles_[i].total() * tiles_[i].elemSize();
+		}
+	}
+	return bytes;
+}
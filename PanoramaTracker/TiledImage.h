@@ -0,0 +1,72 @@
+#pragma once
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <cstring>
+
+using namespace cv;
+
+/*
+Single channel image stored as a grid of equally sized tiles. A tile is allocated only when
+something other than zero is written to it, so unallocated tiles read as black pixels.
+The tiles at the right and bottom edges are cut to the image size.
+Copies of a tiled image share the tiles. A shared tile is copied before it is written, so a copy can be
+read on one thread while the image it was copied from is written on another
+*/
+class TiledImage
+{
+public:
+	TiledImage();
+	TiledImage(Size imageSize, Size tileSize, int type);
+
+	Size GetSize() const;
+	Size GetTileSize() const;
+	int GetType() const;
+
+	//Number of tiles in x and y directions
+	int TilesX() const;
+	int TilesY() const;
+
+	//Rect of the tile tx,ty in image coordinates
+	Rect GetTileRect(int tx, int ty) const;
+
+	bool IsAllocated(int tx, int ty) const;
+
+	//Get the tile tx,ty. Returns the stored tile, or a new black image if the tile is not allocated
+	Mat GetTile(int tx, int ty) const;
+
+	//Get the tile tx,ty for writing, allocating it if necessary and copying it if it is shared
+	Mat GetTileForWrite(int tx, int ty);
+
+	//Get an area of the image. Returns a view to the tile if the area is inside one allocated tile, otherwise a copy
+	Mat GetRegion(const Rect &area) const;
+
+	//Copy image to the area with origin at the top left corner. Only pixels that are non-zero in mask are copied if mask is given
+	void SetRegion(const Mat &image, Point origin, const Mat &mask = Mat());
+
+	//Copy length pixels to the row starting at origin, e.g. a span of new pixels of a map row. The row must be inside the image
+	void SetRow(const uchar *pixels, Point origin, int length);
+
+	//Set every pixel of the area to value. Setting zero does not allocate tiles
+	void SetTo(const Rect &area, uchar value);
+
+	//Assemble the whole image
+	Mat ToMat() const;
+
+	//Bytes used by the allocated tiles
+	size_t GetMemoryFootprint() const;
+
+private:
+	Size image_size_;
+	Size tile_size_;
+	int type_;
+	int tiles_x_;
+	int tiles_y_;
+
+	//Tiles in row major order, empty Mats are unallocated
+	std::vector<Mat> tiles_;
+
+	//Range of tiles touched by area
+	void tileRange(const Rect &area, int &txBegin, int &tyBegin, int &txEnd, int &tyEnd) const;
+};
@@ -2,13 +2,13 @@
 #include <opencv2/video/tracking.hpp>
 
 Viewpoint::Viewpoint()
-: x(0), y(0), height(0), width(0)
+: x(0), y(0), precise_x(0), precise_y(0), height(0), width(0)
 {
 	
 }
 
 Viewpoint::Viewpoint(int x, int y, int width, int height)
-: x(x), y(y), height(height), width(width)
+: x(x), y(y), precise_x(x), precise_y(y), height(height), width(width)
 {
 	
 }
@@ -35,29 +35,36 @@ void Viewpoint::UpdateViewpointSize(int width, int height, int mapWidth, int map
 	this->width = width;
 }
 
-void Viewpoint::updateViewpointLocation(float x_move, float y_move, int map_width, int map_height, const Mat &mask_image)
+void Viewpoint::updateViewpointLocation(float x_move, float y_move, int map_width, int map_height)
 {	
 	//Limit viewpoint from moving out of image borders
-	if (x + round(x_move) >= 0 && x + round(x_move) + width <= map_width)
+	//The moves are accumulated to the fractional location, so that small moves are not lost to rounding
+	int new_x = round(precise_x + x_move);
+	if (new_x >= 0 && new_x + width <= map_width)
 	{
-		x += round(x_move);
+		precise_x += x_move;
+		x = new_x;
 	}
 
-	if (y + round(y_move) > 0 && y + round(y_move) + height < map_height)
+	int new_y = round(precise_y + y_move);
+	if (new_y > 0 && new_y + height < map_height)
 	{
-		y += round(y_move);
+		precise_y += y_move;
+		y = new_y;
 	}
 }
 
 void Viewpoint::updateViewpointLocationCnst(float x, float y)
 {
-	this->x = x;
-	this->y = y;
+	this->x = round(x);
+	this->y = round(y);
+	precise_x = x;
+	precise_y = y;
 }
 
 
-void Viewpoint::DrawViewpoint(Mat& image, MapSize mapSize) const
+void Viewpoint::DrawViewpoint(Mat& image, MapSize mapSize, Point offset) const
 {
-	rectangle(image, GetViewpoint(mapSize), Scalar(0, 0, 255), 2);
+	rectangle(image, GetViewpoint(mapSize) - offset, Scalar(0, 0, 255), 2);
 }
 
@@ -14,6 +14,9 @@ class Viewpoint
 public:
 	//x and y coordinates of top left corner of the largest viewpoint
 	int x, y;				
+
+	//Fractional location of the top left corner, x and y are its rounded values
+	float precise_x, precise_y;
 	
 	//Width and height of the viewpoint
 	int height, width;
@@ -29,14 +32,15 @@ public:
 	void UpdateViewpointSize(int width, int height, int mapWidth, int mapHeight);
 	
 	//Move viewpoint by x_move and y_move
-	void updateViewpointLocation(float x_move, float y_move, int map_width, int map_height, const Mat &mask_image);
+	void updateViewpointLocation(float x_move, float y_move, int map_width, int map_height);
 
 	//Move viewpoint to a specific location
 	void updateViewpointLocationCnst(float x, float y);
 
 
 	//Draw viewpoint on top of the map image (image), used in the Unity3D plugin
-	void DrawViewpoint(Mat &image, MapSize mapSize) const;
+	//offset is the location of the top left corner of image in the map
+	void DrawViewpoint(Mat &image, MapSize mapSize, Point offset = Point(0, 0)) const;
 
 private:
 
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+
+/*
+Owner of a background worker whose thread works on the tracker that created it.
+Moving a tracker does not move its workers, their threads would keep using the moved-from tracker.
+Moving a handle therefore stops the worker of the moved-from handle and leaves the moved-to handle empty,
+and the tracker starts new workers when it needs them. The handles are declared before everything the
+workers use, so that the workers are stopped before those members are moved or overwritten
+*/
+template <typename T>
+class WorkerHandle
+{
+public:
+	WorkerHandle() {}
+	WorkerHandle(WorkerHandle &&other)
+	{
+		other.reset();
+	}
+	WorkerHandle &operator=(WorkerHandle &&other)
+	{
+		reset();
+		other.reset();
+		return *this;
+	}
+
+	//Stop the current worker and take ownership of worker
+	void reset(T *worker = nullptr) { ptr_.reset(worker); }
+
+	T *operator->() const { return ptr_.get(); }
+	explicit operator bool() const { return ptr_ != nullptr; }
+private:
+	std::unique_ptr<T> ptr_;
+};